@@ -214,6 +214,14 @@ static inline uint64 r_time()
     return x;
 }
 
+// 读取时钟周期计数 (cycle寄存器)
+static inline uint64 r_cycle()
+{
+    uint64 x;
+    asm volatile("csrr %0, cycle" : "=r"(x));
+    return x;
+}
+
 // 打开设备中断
 static inline void intr_on()
 {
@@ -268,3 +276,15 @@ static inline void sfence_vma()
 {
     asm volatile("sfence.vma zero, zero");
 }
+
+// 刷新TLB中属于某个ASID的全部表项
+static inline void sfence_vma_asid(uint64 asid)
+{
+    asm volatile("sfence.vma zero, %0" : : "r"(asid));
+}
+
+// 刷新TLB中属于某个ASID的某个虚拟地址的表项
+static inline void sfence_vma_va_asid(uint64 va, uint64 asid)
+{
+    asm volatile("sfence.vma %0, %1" : : "r"(va), "r"(asid));
+}
@@ -36,6 +36,7 @@ typedef enum
 #define MSTATUS_MPP_S (1L << 11)
 #define MSTATUS_MPP_U (0L << 11)
 #define MSTATUS_MIE (1L << 3)
+#define MSTATUS_VS_INITIAL (1L << 9) // 向量扩展状态: Initial (VS=0时向量指令非法)
 
 /* Supervisor Status Register (sstatus) */
 #define SSTATUS_SPP (1L << 8)
@@ -42,6 +42,9 @@ void start()
     uint64 status_val = r_mstatus();
     status_val &= ~MSTATUS_MPP_MASK; // 清除 MPP 位
     status_val |= MSTATUS_MPP_S;     // 设置为 Supervisor 模式
+#ifdef CONFIG_RVV
+    status_val |= MSTATUS_VS_INITIAL; // 允许使用向量指令 (memset/memmove)
+#endif
     w_mstatus(status_val);
 
     // 7. 设置 mret 的返回地址 (mepc)
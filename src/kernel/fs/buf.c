@@ -38,6 +38,17 @@ static void insert_node(buffer_node_t *node, bool insert_active, bool insert_nex
 	}
 }
 
+/*
+	内存紧张时的回收函数: 释放非活跃buffer持有的物理页
+	其他模块持有lk_buf_cache时也可能申请物理页, 此时直接放弃, 避免自锁
+*/
+static uint32 buffer_reclaim(uint32 target)
+{
+	if (spinlock_holding(&lk_buf_cache))
+		return 0;
+	return buffer_freemem(target);
+}
+
 /* 
 	buffer系统初始化：
 	1. 初始化全局的lk_buf_cache + buf_head_active + buf_head_inactive
@@ -61,6 +72,9 @@ void buffer_init()
         
         insert_node(node, false, true); // 插入 inactive 链表
     }
+
+    // 内存紧张时允许pmem回收非活跃buffer持有的物理页
+    pmem_register_reclaim(buffer_reclaim);
 }
 
 /* 磁盘读取: block -> buf */
@@ -75,55 +89,90 @@ void buffer_write(buffer_t *buf)
 	virtio_disk_rw(buf, true);
 }
 
+/*
+	为buffer申请存放数据的物理页 (随后会被磁盘数据覆盖, 不需要清零)
+	调用者不能持有lk_buf_cache, 这样回收链可以释放非活跃buffer的物理页, 换出也可以睡眠
+	pmem_alloc_flags失败前已经运行回收链并请求其他CPU归还本地缓存,
+	此时让出CPU等待其他CPU响应后再重试一次
+*/
+static uint8 *buffer_alloc_data()
+{
+	uint8 *data = (uint8 *)pmem_alloc_flags(false, 0);
+	if (data == NULL && myproc() != NULL) {
+		proc_yield();
+		data = (uint8 *)pmem_alloc_flags(false, 0);
+	}
+	if (data == NULL)
+		panic("buffer_get: pmem alloc failed");
+	return data;
+}
+
 /* 从buf_cache中获取一个buf */
 buffer_t* buffer_get(uint32 block_num)
 {
+    uint8 *spare = NULL; // 释放锁期间申请的物理页
+    buffer_node_t *node;
+
 	spinlock_acquire(&lk_buf_cache);
 
-    // 1. 在活跃链表中查找
-    buffer_node_t *node = buf_head_active.next;
-    while (node != &buf_head_active) {
-        if (node->buf.block_num == block_num) {
-            node->buf.ref++;
-            spinlock_release(&lk_buf_cache);
-            sleeplock_acquire(&node->buf.slk);
-            return &node->buf;
+    // 申请物理页时需要释放锁, 重新获取锁后其他CPU可能已经读入了这个block, 因此从头查找
+    for (;;) {
+        // 1. 在活跃链表中查找
+        node = buf_head_active.next;
+        while (node != &buf_head_active) {
+            if (node->buf.block_num == block_num) {
+                node->buf.ref++;
+                spinlock_release(&lk_buf_cache);
+                if (spare != NULL)
+                    pmem_free((uint64)spare, false);
+                sleeplock_acquire(&node->buf.slk);
+                return &node->buf;
+            }
+            node = node->next;
         }
-        node = node->next;
-    }
 
-    // 2. 在非活跃链表中查找 (缓存复活)
-    node = buf_head_inactive.next;
-    while (node != &buf_head_inactive) {
-        if (node->buf.block_num == block_num) {
-            node->buf.ref = 1;
-            insert_node(node, true, true); // 移入 active
-            spinlock_release(&lk_buf_cache);
-            sleeplock_acquire(&node->buf.slk);
-            return &node->buf;
+        // 2. 在非活跃链表中查找 (缓存复活)
+        node = buf_head_inactive.next;
+        while (node != &buf_head_inactive) {
+            if (node->buf.block_num == block_num) {
+                node->buf.ref = 1;
+                insert_node(node, true, true); // 移入 active
+                spinlock_release(&lk_buf_cache);
+                if (spare != NULL)
+                    pmem_free((uint64)spare, false);
+                sleeplock_acquire(&node->buf.slk);
+                return &node->buf;
+            }
+            node = node->next;
         }
-        node = node->next;
-    }
 
-    // 3. 缓存未命中，从非活跃链表分配一个 (LRU Victim)
-    // 这里简单地取 inactive 的第一个节点
-    node = buf_head_inactive.next;
-    if (node == &buf_head_inactive) {
-        panic("buffer_get: no free buffers");
+        // 3. 缓存未命中，从非活跃链表分配一个 (LRU Victim)
+        // 这里简单地取 inactive 的第一个节点
+        node = buf_head_inactive.next;
+        if (node == &buf_head_inactive) {
+            panic("buffer_get: no free buffers");
+        }
+        if (node->buf.data != NULL || spare != NULL)
+            break;
+
+        // 该 buffer 还没有物理页: 释放锁后申请
+        spinlock_release(&lk_buf_cache);
+        spare = buffer_alloc_data();
+        spinlock_acquire(&lk_buf_cache);
     }
 
     // 初始化节点信息
     node->buf.block_num = block_num;
     node->buf.ref = 1;
-    
-    // 如果该 buffer 还没有分配物理页，则分配
     if (node->buf.data == NULL) {
-        node->buf.data = (uint8 *)pmem_alloc(false);
-        if (!node->buf.data) panic("buffer_get: pmem alloc failed");
+        node->buf.data = spare;
+        spare = NULL;
     }
 
     insert_node(node, true, true); // 移入 active
     spinlock_release(&lk_buf_cache);
+    if (spare != NULL)
+        pmem_free((uint64)spare, false);
 
     // 获取睡眠锁并从磁盘读取数据
     sleeplock_acquire(&node->buf.slk);
@@ -150,6 +199,35 @@ void buffer_put(buffer_t *buf)
     sleeplock_release(&buf->slk);
 }
 
+/*
+	丢弃block在buf_cache中的副本 (保留buffer的物理页)
+	用于绕过buf_cache直接读写磁盘的场景 (交换区借用的data block),
+	避免这个block之后重新交给文件系统时读到过时的缓存内容
+	调用者保证此时没有人正在使用这个block的buffer
+*/
+void buffer_invalidate(uint32 block_num)
+{
+	spinlock_acquire(&lk_buf_cache);
+
+    buffer_node_t *node = buf_head_inactive.next;
+    while (node != &buf_head_inactive) {
+        if (node->buf.block_num == block_num) {
+            node->buf.block_num = BLOCK_NUM_UNUSED;
+            break;
+        }
+        node = node->next;
+    }
+
+    node = buf_head_active.next;
+    while (node != &buf_head_active) {
+        if (node->buf.block_num == block_num)
+            panic("buffer_invalidate: block in use");
+        node = node->next;
+    }
+
+    spinlock_release(&lk_buf_cache);
+}
+
 /*
 	从后向前遍历非活跃链表, 尝试释放buffer_count个buffer持有的物理内存(data)
 	返回成功释放资源的buffer数量
@@ -36,9 +36,8 @@ typedef struct used_area {
 } used_area_t;
 
 typedef struct disk {
-    // 驱动需要8KB的连续空间, 不适合用pmem_alloc来申请
-    // 所以直接定义在这里
-    char pages[2 * PGSIZE];
+    // 驱动需要8KB的物理连续空间, 在初始化时用pmem_alloc_order(1, true)申请
+    char *pages;
     
     vring_desc_t *desc;
     used_area_t *used;
@@ -1,6 +1,6 @@
 #include "mod.h"
 
-static __attribute__((aligned(PGSIZE))) disk_t disk;
+static disk_t disk;
 
 /* 初始化虚拟磁盘 */
 void virtio_disk_init()
@@ -51,7 +51,9 @@ void virtio_disk_init()
     if (max < VIRTIO_NUM)
         panic("virtio disk max queue too short");
     *R(VIRTIO_MMIO_QUEUE_NUM) = VIRTIO_NUM;
-    memset(disk.pages, 0, sizeof(disk.pages));
+    disk.pages = (char *)pmem_alloc_order(1, true); // 已清零
+    if (disk.pages == NULL)
+        panic("virtio disk alloc queue failed");
     *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> 12;
 
     // desc = pages -- num * VRingDesc
@@ -164,11 +166,7 @@ void virtio_disk_rw(buffer_t *b, bool write)
 
     // buf0 is on a kernel stack, which is not direct mapped,
     // thus the call to kvmpa().
-    uint64 addr = ALIGN_DOWN((uint64)&buf0, PGSIZE);
-    uint64 off = ((uint64)&buf0) % PGSIZE;
-    pte_t *pte = vm_getpte(NULL, addr, false);
-
-    disk.desc[idx[0]].addr = (uint64)PTE_TO_PA(*pte) + off;
+    disk.desc[idx[0]].addr = vm_translate(NULL, (uint64)&buf0);
     disk.desc[idx[0]].len = sizeof(buf0);
     disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
     disk.desc[idx[0]].next = idx[1];
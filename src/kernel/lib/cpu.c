@@ -8,6 +8,12 @@ cpu_t *mycpu(void)
     return &cpus[hartid];
 }
 
+// 按编号获取CPU (读取其他CPU的状态只能作为提示)
+cpu_t *cpu_get(int id)
+{
+    return &cpus[id];
+}
+
 int mycpuid(void)
 {
     int hartid = r_tp();
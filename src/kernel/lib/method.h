@@ -18,6 +18,7 @@ void uart_intr(void);
 
 int mycpuid(void);
 cpu_t *mycpu(void);
+cpu_t *cpu_get(int id);
 proc_t *myproc(void);
 
 /* utils.c: 一些常用的工具函数 */
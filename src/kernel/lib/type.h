@@ -44,5 +44,6 @@ typedef struct cpu
     int noff;       // 关中断的深度
     int origin;     // 第一次关中断前的状态
     proc_t *proc;   // cpu上运行的进程
+    uint64 asid_gen; // 该cpu的TLB对应的ASID代号
     context_t ctx;  // 内核自身上下文
 } cpu_t;
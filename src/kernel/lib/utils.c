@@ -1,26 +1,173 @@
 #include "mod.h"
 
+/*
+ * memset 和 memmove 位于页面清零、fork复制、copyin/copyout、缓冲区拷贝等热点路径上
+ * 默认实现按8字节对齐的字读写并展开循环
+ * 以 RVV=1 编译时 (定义 CONFIG_RVV) 改用RISC-V向量扩展实现
+ */
+
+#define WORD_SIZE  8
+#define WORD_MASK  (WORD_SIZE - 1)
+#define BLOCK_SIZE (8 * WORD_SIZE) // 展开后每轮处理的字节数
+
+#ifdef CONFIG_RVV
+
+/*
+ * 向量寄存器不属于进程上下文, 内核抢占和中断处理都不会保存它们
+ * 因此使用向量寄存器期间关闭中断; 为了限制中断延迟, 每次关中断最多处理 VECTOR_CHUNK 个字节,
+ * 每一段都重新设置 vl 并且读写完毕, 段与段之间不依赖向量寄存器的内容
+ * 内核其余代码(包括本文件)仍按 rv64gc 编译, 只在下面的内联汇编内部临时启用V扩展,
+ * 保证编译器不会在关中断区域之外自行生成向量指令(例如结构体拷贝)
+ */
+#define VECTOR_ASM(insns) ".option push\n\t.option arch, +v\n\t" insns "\n\t.option pop"
+#define VECTOR_CHUNK 1024
+
 // 从begin开始对连续n个字节赋值data
 void memset(void *begin, uint8 data, uint32 n)
 {
-    uint8 *list = (uint8 *)begin;
-    for (uint32 i = 0; i < n; i++)
-        list[i] = data;
+    uint8 *d = (uint8 *)begin;
+    uint64 vl;
+
+    while (n > 0) {
+        uint32 chunk = MIN(n, VECTOR_CHUNK);
+        n -= chunk;
+
+        push_off();
+        for (; chunk > 0; chunk -= vl, d += vl) {
+            asm volatile(VECTOR_ASM("vsetvli %0, %1, e8, m8, ta, ma") : "=r"(vl) : "r"((uint64)chunk));
+            asm volatile(VECTOR_ASM("vmv.v.x v0, %0\n\tvse8.v v0, (%1)") : : "r"((uint64)data), "r"(d) : "memory");
+        }
+        pop_off();
+    }
 }
 
-// 从src向dst拷贝n个字节的数据
+// 从src向dst拷贝n个字节的数据, 允许两个区间重叠
 void memmove(void *dst, const void *src, uint32 n)
 {
-    char *d = dst;
-    const char *s = src;
-    while (n--)
-    {
-        *d = *s;
-        d++;
-        s++;
+    uint8 *d = (uint8 *)dst;
+    const uint8 *s = (const uint8 *)src;
+    uint64 vl;
+
+    if (d == s || n == 0)
+        return;
+
+    // 每一小段都先整体读入向量寄存器再写出
+    // 目的区间在源区间之后且重叠时从尾部开始拷贝 (段和段内都是从后往前), 否则从头部开始
+    bool backward = (d > s && d < s + n);
+
+    while (n > 0) {
+        uint32 chunk = MIN(n, VECTOR_CHUNK);
+        uint8 *cd = backward ? d + n - chunk : d;
+        const uint8 *cs = backward ? s + n - chunk : s;
+
+        push_off();
+        for (uint32 left = chunk; left > 0; left -= vl) {
+            asm volatile(VECTOR_ASM("vsetvli %0, %1, e8, m8, ta, ma") : "=r"(vl) : "r"((uint64)left));
+            uint64 off = backward ? left - vl : chunk - left;
+            asm volatile(VECTOR_ASM("vle8.v v0, (%0)\n\tvse8.v v0, (%1)") : : "r"(cs + off), "r"(cd + off) : "memory");
+        }
+        pop_off();
+
+        if (!backward) {
+            d += chunk;
+            s += chunk;
+        }
+        n -= chunk;
     }
 }
 
+#else
+
+// 允许与其他类型的指针互为别名的字类型
+typedef uint64 __attribute__((may_alias)) word_t;
+
+// 从begin开始对连续n个字节赋值data
+void memset(void *begin, uint8 data, uint32 n)
+{
+    uint8 *d = (uint8 *)begin;
+
+    // 先逐字节填充到8字节对齐
+    while (n > 0 && ((uint64)d & WORD_MASK)) {
+        *d++ = data;
+        n--;
+    }
+
+    // 把data复制到字的每一个字节, 再按字填充
+    word_t word = data * 0x0101010101010101ul;
+    word_t *w = (word_t *)d;
+    for (; n >= BLOCK_SIZE; n -= BLOCK_SIZE, w += 8) {
+        w[0] = word; w[1] = word; w[2] = word; w[3] = word;
+        w[4] = word; w[5] = word; w[6] = word; w[7] = word;
+    }
+    for (; n >= WORD_SIZE; n -= WORD_SIZE)
+        *w++ = word;
+
+    // 剩余不足一个字的部分
+    d = (uint8 *)w;
+    while (n-- > 0)
+        *d++ = data;
+}
+
+// 从src向dst拷贝n个字节的数据, 允许两个区间重叠
+// 两个地址对8取模相同时按字拷贝, 否则只能逐字节拷贝 (避免非对齐访存)
+void memmove(void *dst, const void *src, uint32 n)
+{
+    uint8 *d = (uint8 *)dst;
+    const uint8 *s = (const uint8 *)src;
+    bool word_ok = (((uint64)d ^ (uint64)s) & WORD_MASK) == 0;
+
+    if (d == s || n == 0)
+        return;
+
+    if (d < s || d >= s + n) {
+        // 正向拷贝: 写入位置总是在尚未读取的源数据之前
+        if (word_ok) {
+            while (n > 0 && ((uint64)d & WORD_MASK)) {
+                *d++ = *s++;
+                n--;
+            }
+            word_t *wd = (word_t *)d;
+            const word_t *ws = (const word_t *)s;
+            for (; n >= BLOCK_SIZE; n -= BLOCK_SIZE, wd += 8, ws += 8) {
+                wd[0] = ws[0]; wd[1] = ws[1]; wd[2] = ws[2]; wd[3] = ws[3];
+                wd[4] = ws[4]; wd[5] = ws[5]; wd[6] = ws[6]; wd[7] = ws[7];
+            }
+            for (; n >= WORD_SIZE; n -= WORD_SIZE)
+                *wd++ = *ws++;
+            d = (uint8 *)wd;
+            s = (const uint8 *)ws;
+        }
+        while (n-- > 0)
+            *d++ = *s++;
+    } else {
+        // 目的区间与源区间重叠且位于其后: 从尾部反向拷贝
+        d += n;
+        s += n;
+        if (word_ok) {
+            while (n > 0 && ((uint64)d & WORD_MASK)) {
+                *--d = *--s;
+                n--;
+            }
+            word_t *wd = (word_t *)d;
+            const word_t *ws = (const word_t *)s;
+            for (; n >= BLOCK_SIZE; n -= BLOCK_SIZE) {
+                wd -= 8;
+                ws -= 8;
+                wd[7] = ws[7]; wd[6] = ws[6]; wd[5] = ws[5]; wd[4] = ws[4];
+                wd[3] = ws[3]; wd[2] = ws[2]; wd[1] = ws[1]; wd[0] = ws[0];
+            }
+            for (; n >= WORD_SIZE; n -= WORD_SIZE)
+                *--wd = *--ws;
+            d = (uint8 *)wd;
+            s = (const uint8 *)ws;
+        }
+        while (n-- > 0)
+            *--d = *--s;
+    }
+}
+
+#endif
+
 // 字符串p的前n个字符与q做比较
 // 按照ASCII码大小逐个比较
 // 相同返回0 大于或小于返回正数或负数
@@ -31,4 +178,4 @@ int strncmp(const char *p, const char *q, uint32 n)
     if (n == 0)
         return 0;
     return (uint8)*p - (uint8)*q;
-}
\ No newline at end of file
+}
@@ -7,6 +7,41 @@
 
 volatile static int started = 0;
 
+#ifdef MEM_BENCH
+// 输出每个时钟周期处理的字节数 (保留两位小数)
+static void mem_bench_report(char *name, uint64 bytes, uint64 cycles)
+{
+    uint64 rate = (cycles == 0) ? 0 : bytes * 100 / cycles;
+    printf("mem_bench: %s %d bytes in %d cycles, %d.%d%d bytes/cycle\n", name,
+           (int)bytes, (int)cycles, (int)(rate / 100), (int)(rate / 10 % 10), (int)(rate % 10));
+}
+
+// 微基准测试: 4KiB页面的填充和拷贝, 以及向用户页表的拷贝 (make MEMBENCH=1)
+static void mem_bench()
+{
+    const int rounds = 256;
+    void *a = pmem_alloc(true);
+    void *b = pmem_alloc(true);
+    if (a == NULL || b == NULL)
+        panic("mem_bench: pmem_alloc failed");
+
+    uint64 begin = r_cycle();
+    for (int i = 0; i < rounds; i++)
+        memset(a, (uint8)i, PGSIZE);
+    mem_bench_report("memset page", (uint64)rounds * PGSIZE, r_cycle() - begin);
+
+    begin = r_cycle();
+    for (int i = 0; i < rounds; i++)
+        memmove(b, a, PGSIZE);
+    mem_bench_report("memmove page", (uint64)rounds * PGSIZE, r_cycle() - begin);
+
+    pmem_free((uint64)a, true);
+    pmem_free((uint64)b, true);
+
+    uvm_copy_bench();
+}
+#endif
+
 int main()
 {
     int cpuid = r_tp();
@@ -16,15 +51,29 @@ int main()
         print_init();
         printf("cpu %d is booting!\n", cpuid);
 
+        // 记录启动阶段的耗时 (time寄存器的计数单位)
+        uint64 boot_begin = r_time();
         pmem_init();
+        printf("pmem_init: %d ticks\n", (int)(r_time() - boot_begin));
         kvm_init();
         kvm_inithart();
+        asid_init();
+        kmalloc_init();
         mmap_init();
+        shm_init();
+        ksm_init();
         virtio_disk_init();
         proc_init();
         proc_make_first();
         trap_kernel_init();
         trap_kernel_inithart();
+        printf("kernel init: %d ticks\n", (int)(r_time() - boot_begin));
+#ifdef MEM_BENCH
+        mem_bench();
+#endif
+#ifdef WAKE_BENCH
+        proc_wake_bench();
+#endif
 
         __sync_synchronize();
         started = 1;
@@ -0,0 +1,100 @@
+#include "mod.h"
+
+/*
+ * 用户地址空间的ASID管理
+ * 分配规则见 type.h 中关于 ASID 的说明
+ */
+
+static spinlock_t asid_lk;     // 保护下面三个变量
+static uint64 asid_generation; // 当前代号 (从1开始)
+static uint64 next_asid;       // 本代下一个可分配的ASID
+static uint64 nr_asids;        // 硬件支持的ASID数量 (包括内核使用的0), 不超过1时表示不支持
+
+// 所有CPU构成的集合
+#define ALL_CPUS ((1u << NCPU) - 1)
+
+/*
+ * ASID初始化 (在hart 0开启分页之后调用)
+ * 向satp的ASID字段写入全1再读回, 得到硬件实际支持的ASID位数
+ */
+void asid_init()
+{
+    uint64 satp = r_satp();
+    w_satp(satp | (SATP_ASID_MASK << SATP_ASID_SHIFT));
+    uint64 asid_bits = (r_satp() >> SATP_ASID_SHIFT) & SATP_ASID_MASK;
+    w_satp(satp);
+    sfence_vma();
+
+    spinlock_init(&asid_lk, "asid");
+    asid_generation = 1;
+    next_asid = 1;
+    nr_asids = asid_bits + 1;
+
+    printf("asid: %d asids available\n", (int)nr_asids);
+}
+
+/*
+ * 在返回用户态之前调用 (需要关闭中断), 返回应该写入satp的值
+ * 1. 进程的ASID属于旧的代时重新分配
+ * 2. 本CPU的TLB属于旧的代时刷新整个TLB
+ * 3. 本CPU被标记为过期时刷新该ASID的全部表项
+ */
+uint64 asid_activate(proc_t *p)
+{
+    if (nr_asids <= 1)
+        return MAKE_SATP(p->pgtbl);
+
+    int id = mycpuid();
+    cpu_t *c = mycpu();
+
+    spinlock_acquire(&asid_lk);
+    if (ASID_GEN(p->asid) != asid_generation) {
+        // 本代的ASID已经用完: 进入下一代
+        if (next_asid == nr_asids) {
+            asid_generation++;
+            next_asid = 1;
+        }
+        // 新分配的ASID在本代中还没有被任何CPU使用过
+        p->asid = (asid_generation << ASID_GEN_SHIFT) | next_asid++;
+        __sync_fetch_and_and(&p->tlb_stale, 0);
+    }
+    uint64 gen = asid_generation;
+    uint64 asid = ASID_OF(p->asid);
+    spinlock_release(&asid_lk);
+
+    if (c->asid_gen != gen) {
+        sfence_vma();
+        c->asid_gen = gen;
+        __sync_fetch_and_and(&p->tlb_stale, ~(1u << id));
+    }
+
+    if (p->tlb_stale & (1u << id)) {
+        __sync_fetch_and_and(&p->tlb_stale, ~(1u << id));
+        sfence_vma_asid(asid);
+    }
+
+    return MAKE_SATP_ASID(p->pgtbl, asid);
+}
+
+/*
+ * 进程p的用户页表中 [va, va + len) 的映射被修改后调用
+ * 刷新本CPU上的相关表项, 其他CPU在下次运行该进程之前刷新
+ */
+void asid_flush(proc_t *p, uint64 va, uint64 len)
+{
+    uint64 asid = ASID_OF(p->asid);
+
+    // 尚未分配ASID的进程还没有运行过; 不支持ASID时trampoline会刷新整个TLB
+    if (asid == 0)
+        return;
+
+    push_off();
+    if (len > TLB_FLUSH_PAGES * PGSIZE) {
+        sfence_vma_asid(asid);
+    } else {
+        for (uint64 a = ALIGN_DOWN(va, PGSIZE); a < va + len; a += PGSIZE)
+            sfence_vma_va_asid(a, asid);
+    }
+    __sync_fetch_and_or(&p->tlb_stale, ALL_CPUS & ~(1u << mycpuid()));
+    pop_off();
+}
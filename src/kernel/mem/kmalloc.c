@@ -0,0 +1,216 @@
+#include "mod.h"
+
+// 各尺寸级别的对象仓库: size = 1 << (KMALLOC_MIN_SHIFT + i)
+static kmem_cache_t caches[KMALLOC_NCLASS];
+
+// slab页面中第一个对象的偏移量
+#define SLAB_OBJ_OFFSET ALIGN_UP(sizeof(slab_t), 16)
+
+/* --------------------------- slab链表 (调用者需持有 cache->lk) --------------------------- */
+
+static void slab_list_add(slab_t *head, slab_t *slab)
+{
+    slab->next = head->next;
+    slab->prev = head;
+    head->next->prev = slab;
+    head->next = slab;
+}
+
+static void slab_list_del(slab_t *slab)
+{
+    slab->prev->next = slab->next;
+    slab->next->prev = slab->prev;
+}
+
+// 申请一个新的slab页面并切分成对象
+static slab_t *slab_create(kmem_cache_t *cache)
+{
+    slab_t *slab = (slab_t *)pmem_alloc_flags(true, 0);
+    if (slab == NULL)
+        return NULL;
+
+    slab->magic = SLAB_MAGIC;
+    slab->inuse = 0;
+    slab->cache = cache;
+    slab->free = NULL;
+
+    // 倒序串联, 使得空闲链表按地址递增
+    for (int i = cache->per_slab - 1; i >= 0; i--) {
+        kmem_obj_t *obj = (kmem_obj_t *)((uint64)slab + SLAB_OBJ_OFFSET + i * cache->size);
+        obj->next = slab->free;
+        slab->free = obj;
+    }
+
+    return slab;
+}
+
+// 把一个对象放回它所在的slab, slab空了就把页面还给pmem
+static void slab_put_obj(kmem_cache_t *cache, kmem_obj_t *obj)
+{
+    slab_t *slab = (slab_t *)ALIGN_DOWN((uint64)obj, PGSIZE);
+
+    // 原本是满的slab, 现在有了空闲对象
+    if (slab->free == NULL) {
+        slab_list_del(slab);
+        slab_list_add(&cache->partial, slab);
+    }
+
+    obj->next = slab->free;
+    slab->free = obj;
+    slab->inuse--;
+    cache->nr_inuse--;
+
+    if (slab->inuse == 0) {
+        slab_list_del(slab);
+        cache->nr_slabs--;
+        slab->magic = 0;
+        pmem_free((uint64)slab, true);
+    }
+}
+
+/* --------------------------- CPU本地链表 (调用者需关闭中断) --------------------------- */
+
+// 从slab批量搬运对象到本地链表
+static void kmem_cpu_refill(kmem_cache_t *cache, kmem_cpu_t *cpu)
+{
+    spinlock_acquire(&cache->lk);
+
+    for (int i = 0; i < KMEM_CPU_BATCH; i++) {
+        slab_t *slab = cache->partial.next;
+        if (slab == &cache->partial) {
+            slab = slab_create(cache);
+            if (slab == NULL)
+                break;
+            slab_list_add(&cache->partial, slab);
+            cache->nr_slabs++;
+        }
+
+        kmem_obj_t *obj = slab->free;
+        slab->free = obj->next;
+        slab->inuse++;
+        cache->nr_inuse++;
+
+        // slab被取空, 移入full链表
+        if (slab->free == NULL) {
+            slab_list_del(slab);
+            slab_list_add(&cache->full, slab);
+        }
+
+        obj->next = cpu->free;
+        cpu->free = obj;
+        cpu->count++;
+    }
+
+    spinlock_release(&cache->lk);
+}
+
+// 从本地链表批量归还对象到各自的slab
+static void kmem_cpu_drain(kmem_cache_t *cache, kmem_cpu_t *cpu)
+{
+    spinlock_acquire(&cache->lk);
+
+    for (int i = 0; i < KMEM_CPU_BATCH && cpu->free != NULL; i++) {
+        kmem_obj_t *obj = cpu->free;
+        cpu->free = obj->next;
+        cpu->count--;
+        slab_put_obj(cache, obj);
+    }
+
+    spinlock_release(&cache->lk);
+}
+
+/* --------------------------- 对外接口 --------------------------- */
+
+// kmalloc初始化 (需要在pmem_init之后调用)
+void kmalloc_init()
+{
+    for (int i = 0; i < KMALLOC_NCLASS; i++) {
+        kmem_cache_t *cache = &caches[i];
+        cache->size = 1 << (KMALLOC_MIN_SHIFT + i);
+        cache->per_slab = (PGSIZE - SLAB_OBJ_OFFSET) / cache->size;
+        spinlock_init(&cache->lk, "kmem_cache");
+        cache->partial.next = cache->partial.prev = &cache->partial;
+        cache->full.next = cache->full.prev = &cache->full;
+        cache->nr_slabs = 0;
+        cache->nr_inuse = 0;
+        for (int j = 0; j < NCPU; j++) {
+            cache->cpu[j].free = NULL;
+            cache->cpu[j].count = 0;
+        }
+    }
+}
+
+/*
+ * 申请一个至少size字节的内核对象 (内容未初始化)
+ * size超过KMALLOC_MAX或者内核内存耗尽时返回NULL
+ */
+void *kmalloc(uint32 size)
+{
+    if (size == 0 || size > KMALLOC_MAX)
+        return NULL;
+
+    // 找到能容纳size的最小尺寸级别
+    int idx = 0;
+    while ((1u << (KMALLOC_MIN_SHIFT + idx)) < size)
+        idx++;
+    kmem_cache_t *cache = &caches[idx];
+
+    push_off();
+    kmem_cpu_t *cpu = &cache->cpu[mycpuid()];
+
+    if (cpu->free == NULL)
+        kmem_cpu_refill(cache, cpu);
+
+    kmem_obj_t *obj = cpu->free;
+    if (obj != NULL) {
+        cpu->free = obj->next;
+        cpu->count--;
+    }
+
+    pop_off();
+
+    // 内核内存耗尽 (pmem已经运行过回收链)
+    if (obj == NULL)
+        return NULL;
+
+    return (void *)obj;
+}
+
+// 释放kmalloc申请的对象
+void kfree(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    slab_t *slab = (slab_t *)ALIGN_DOWN((uint64)ptr, PGSIZE);
+    if (slab->magic != SLAB_MAGIC)
+        panic("kfree: not a kmalloc object");
+    kmem_cache_t *cache = slab->cache;
+
+    push_off();
+    kmem_cpu_t *cpu = &cache->cpu[mycpuid()];
+
+    kmem_obj_t *obj = (kmem_obj_t *)ptr;
+    obj->next = cpu->free;
+    cpu->free = obj;
+    cpu->count++;
+
+    // 本地链表过长时批量归还
+    if (cpu->count >= KMEM_CPU_HIGH)
+        kmem_cpu_drain(cache, cpu);
+
+    pop_off();
+}
+
+// 输出各尺寸级别的使用情况
+void kmalloc_stat()
+{
+    printf("kmalloc caches:\n");
+    for (int i = 0; i < KMALLOC_NCLASS; i++) {
+        kmem_cache_t *cache = &caches[i];
+        spinlock_acquire(&cache->lk);
+        printf("size %d: slabs = %d, objs per slab = %d, objs out of slabs = %d\n",
+            cache->size, cache->nr_slabs, cache->per_slab, cache->nr_inuse);
+        spinlock_release(&cache->lk);
+    }
+}
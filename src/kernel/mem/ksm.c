@@ -0,0 +1,221 @@
+#include "mod.h"
+
+// 稳定表与不稳定表 (按哈希值分桶)
+static ksm_node_t *stable[KSM_HASH_SIZE];
+static ksm_node_t *unstable[KSM_HASH_SIZE];
+static spinlock_t ksm_lk; // 保护两张表、扫描位置和统计信息
+
+// 扫描位置: 进程池下标 + 进程内的虚拟地址
+static int cursor_proc;
+static uint64 cursor_va;
+
+// 统计信息
+static uint64 full_scans;    // 完成的整轮扫描次数
+static uint64 pages_scanned; // 检查过的页面数
+static uint64 pages_merged;  // 合并到稳定页面的映射数
+static uint32 nr_stable;     // 当前稳定页面的数量
+
+void ksm_init()
+{
+    spinlock_init(&ksm_lk, "ksm");
+    for (int i = 0; i < KSM_HASH_SIZE; i++) {
+        stable[i] = NULL;
+        unstable[i] = NULL;
+    }
+    cursor_proc = 0;
+    cursor_va = 0;
+    full_scans = pages_scanned = pages_merged = 0;
+    nr_stable = 0;
+}
+
+// 页面内容的哈希值 (按字计算的FNV-1a)
+static uint32 ksm_hash(uint64 pa)
+{
+    uint64 *w = (uint64 *)pa;
+    uint64 h = 0xcbf29ce484222325ul;
+    for (int i = 0; i < PGSIZE / sizeof(uint64); i++) {
+        h ^= w[i];
+        h *= 0x100000001b3ul;
+    }
+    return (uint32)(h ^ (h >> 32));
+}
+
+// 两个页面的内容是否完全相同
+static bool ksm_same(uint64 pa1, uint64 pa2)
+{
+    uint64 *a = (uint64 *)pa1, *b = (uint64 *)pa2;
+    for (int i = 0; i < PGSIZE / sizeof(uint64); i++)
+        if (a[i] != b[i])
+            return false;
+    return true;
+}
+
+// 在稳定表中查找与 pa 内容相同的稳定页面
+static ksm_node_t *stable_find(uint32 hash, uint64 pa)
+{
+    for (ksm_node_t *n = stable[hash % KSM_HASH_SIZE]; n != NULL; n = n->next)
+        if (n->hash == hash && (n->pa == pa || ksm_same(n->pa, pa)))
+            return n;
+    return NULL;
+}
+
+// 在不稳定表中记录哈希值, 返回本轮扫描中是否已经见过它
+static bool unstable_seen(uint32 hash)
+{
+    ksm_node_t **head = &unstable[hash % KSM_HASH_SIZE];
+    for (ksm_node_t *n = *head; n != NULL; n = n->next)
+        if (n->hash == hash)
+            return true;
+
+    ksm_node_t *n = (ksm_node_t *)kmalloc(sizeof(ksm_node_t));
+    if (n != NULL) {
+        n->hash = hash;
+        n->pa = 0;
+        n->next = *head;
+        *head = n;
+    }
+    return false;
+}
+
+// 把PTE改为只读: 原本可写(或写时复制)的页面打上 PTE_COW 标记, 写入时复制
+static pte_t ksm_readonly(pte_t pte, uint64 pa)
+{
+    int flags = PTE_FLAGS(pte);
+    if (flags & (PTE_W | PTE_COW))
+        flags = (flags & ~PTE_W) | PTE_COW;
+    return PA_TO_PTE(pa) | flags;
+}
+
+// 检查进程 p 在 va 处的页面 (调用者持有 ksm_lk 和 p->lk)
+static void ksm_scan_page(proc_t *p, uint64 va)
+{
+    int level;
+    pte_t *pte = vm_getleaf(p->pgtbl, va, &level);
+    if (pte == NULL || !(*pte & PTE_V) || !(*pte & PTE_U) || level != 0)
+        return;
+
+    uint64 pa = PTE_TO_PA(*pte);
+    // 可写但被多处引用的页面 (共享内存) 内容随时可能变化
+    if ((*pte & PTE_W) && pmem_refcnt(pa) > 1)
+        return;
+
+    pages_scanned++;
+    uint32 hash = ksm_hash(pa);
+    ksm_node_t *n = stable_find(hash, pa);
+
+    if (n != NULL) {
+        if (n->pa == pa)
+            return; // 已经合并过
+        // 合并: 改为映射稳定页面, 归还对原页面的引用
+        pmem_get(n->pa);
+        *pte = ksm_readonly(*pte, n->pa);
+        asid_flush(p, va, PGSIZE);
+        pmem_free(pa, false);
+        pages_merged++;
+    } else if (unstable_seen(hash)) {
+        // 第二次出现的内容: 提升为稳定页面
+        n = (ksm_node_t *)kmalloc(sizeof(ksm_node_t));
+        if (n == NULL)
+            return;
+        n->hash = hash;
+        n->pa = pa;
+        n->next = stable[hash % KSM_HASH_SIZE];
+        stable[hash % KSM_HASH_SIZE] = n;
+        pmem_get(pa);
+        *pte = ksm_readonly(*pte, pa);
+        asid_flush(p, va, PGSIZE);
+        nr_stable++;
+    }
+}
+
+// 一轮扫描结束: 清空不稳定表, 释放只剩稳定表引用的稳定页面
+static void ksm_pass_done()
+{
+    for (int i = 0; i < KSM_HASH_SIZE; i++) {
+        while (unstable[i] != NULL) {
+            ksm_node_t *n = unstable[i];
+            unstable[i] = n->next;
+            kfree(n);
+        }
+
+        ksm_node_t **link = &stable[i];
+        while (*link != NULL) {
+            ksm_node_t *n = *link;
+            if (pmem_refcnt(n->pa) == 1) {
+                *link = n->next;
+                pmem_free(n->pa, false);
+                kfree(n);
+                nr_stable--;
+            } else {
+                link = &n->next;
+            }
+        }
+    }
+    full_scans++;
+}
+
+/*
+ * 空闲时调用: 从上次的位置继续扫描最多 KSM_SCAN_BATCH 个页面
+ * 其他CPU正在扫描时直接返回
+ */
+void ksm_scan()
+{
+    static int busy;
+    if (__sync_lock_test_and_set(&busy, 1))
+        return;
+
+    spinlock_acquire(&ksm_lk);
+    int budget = KSM_SCAN_BATCH;
+    int visited = 0; // 本次访问过的进程数, 没有可扫描的进程时避免空转
+
+    while (budget > 0 && visited <= N_PROC) {
+        proc_t *p = proc_get(cursor_proc);
+        bool finished = true;
+
+        // 只扫描从用户态让出CPU、等待运行的进程: 睡眠的进程和刚被唤醒的进程 (sleep_space 尚未清除)
+        // 都停在某条内核路径中, 可能持有指向自己PTE的指针 (例如 user_copy)
+        spinlock_acquire(&p->lk);
+        if (p->ksm && p->pgtbl != NULL && p->state == RUNNABLE &&
+            !p->kpreempted && p->sleep_space == NULL) {
+            uint64 va = uvm_next_private_va(p, cursor_va);
+            for (; va != 0 && budget > 0; budget--) {
+                ksm_scan_page(p, va);
+                va = uvm_next_private_va(p, va + PGSIZE);
+            }
+            cursor_va = va;
+            finished = (va == 0);
+        }
+        spinlock_release(&p->lk);
+
+        // 进入下一个进程, 回到进程池开头时完成一轮扫描
+        if (finished) {
+            visited++;
+            cursor_va = 0;
+            if (++cursor_proc == N_PROC) {
+                cursor_proc = 0;
+                ksm_pass_done();
+            }
+        }
+    }
+    spinlock_release(&ksm_lk);
+
+    __sync_lock_release(&busy);
+}
+
+// 输出KSM的统计信息
+void ksm_stat()
+{
+    spinlock_acquire(&ksm_lk);
+    // 每个稳定页面被 (引用数 - 1) 个PTE映射, 其中只有一个物理页面是真正需要的
+    uint64 sharing = 0;
+    for (int i = 0; i < KSM_HASH_SIZE; i++)
+        for (ksm_node_t *n = stable[i]; n != NULL; n = n->next)
+            sharing += pmem_refcnt(n->pa) - 1;
+
+    printf("\n=== KSM Stat ===\n");
+    printf("full scans: %d, pages scanned: %d, merges: %d\n",
+           (int)full_scans, (int)pages_scanned, (int)pages_merged);
+    printf("stable pages: %d, mappings of stable pages: %d, pages saved: %d\n",
+           nr_stable, (int)sharing, (int)(sharing > nr_stable ? sharing - nr_stable : 0));
+    spinlock_release(&ksm_lk);
+}
@@ -4,18 +4,19 @@
 static pgtbl_t kern_pagetable;
 
 /*
- * 在页表中查找虚拟地址对应的页表项(PTE)地址
- * level 2 -> level 1 -> level 0
- * 如果 alloc 为 true，则在缺页时分配新的中间页表页
+ * 内部辅助函数：沿页表向下走到第 target 级, 返回该级的 PTE 地址
+ * alloc 为 true 时在缺页时分配新的中间页表页
+ * 途中遇到更高层的叶子(大页)时:
+ *   leaf_level 非空则返回该叶子并通过 leaf_level 报告其所在层级, 否则返回 NULL
  */
-pte_t *vm_getpte(pgtbl_t table, uint64 virt_addr, bool alloc)
+static pte_t *vm_walk(pgtbl_t table, uint64 virt_addr, bool alloc, int target, int *leaf_level)
 {
     if (table == NULL) // [NEW] 处理pgtbl为NULL的情况
         table = kern_pagetable;
     if (virt_addr >= VA_MAX)
         return NULL;
 
-    for (int level = 2; level > 0; level--) {
+    for (int level = 2; level > target; level--) {
         // 获取当前级页表的索引
         uint64 idx = VA_TO_VPN(virt_addr, level);
         pte_t *entry = &table[idx];
@@ -33,26 +34,152 @@ pte_t *vm_getpte(pgtbl_t table, uint64 virt_addr, bool alloc)
             // 建立连接：当前PTE指向新的页表物理地址，并标记有效
             *entry = PA_TO_PTE((uint64)new_table) | PTE_V;
         } 
-        // 如果遇到了大页映射（叶子节点出现在中间层），这在当前设计中不应该发生
+        // 遇到了大页映射（叶子节点出现在中间层）
         // PTE_CHECK 为 false 表示有权限位，即为叶子节点
         else if (!PTE_CHECK(*entry)) {
-            return NULL;
+            if (leaf_level == NULL)
+                return NULL;
+            *leaf_level = level;
+            return entry;
         }
 
         // 进入下一级页表
         table = (pgtbl_t)PTE_TO_PA(*entry);
     }
 
-    // 返回最底层(level 0)的PTE地址
-    return &table[VA_TO_VPN(virt_addr, 0)];
+    if (leaf_level != NULL)
+        *leaf_level = target;
+    return &table[VA_TO_VPN(virt_addr, target)];
 }
 
 /*
- * 建立内存映射：将虚拟地址区间 [virt_addr, virt_addr + len) 
- * 映射到物理地址 [phys_addr, phys_addr + len)
- * 权限位由 perm 指定
+ * 在页表中查找虚拟地址对应的页表项(PTE)地址
+ * level 2 -> level 1 -> level 0
+ * 如果 alloc 为 true，则在缺页时分配新的中间页表页, 返回第0级的PTE (被大页覆盖时返回NULL)
+ * 如果 alloc 为 false，则返回覆盖该地址的叶子PTE, 它可能位于中间层 (大页)
+ */
+pte_t *vm_getpte(pgtbl_t table, uint64 virt_addr, bool alloc)
+{
+    int level;
+    if (alloc)
+        return vm_walk(table, virt_addr, true, 0, NULL);
+    return vm_walk(table, virt_addr, false, 0, &level);
+}
+
+/*
+ * 查找覆盖虚拟地址的叶子PTE, 并通过 level 报告它所在的层级
+ * 叶子映射的大小为 LEVEL_PGSIZE(level)
+ */
+pte_t *vm_getleaf(pgtbl_t table, uint64 virt_addr, int *level)
+{
+    return vm_walk(table, virt_addr, false, 0, level);
+}
+
+/*
+ * 虚拟地址 -> 物理地址 (考虑大页内的偏移)
+ * 没有有效映射时返回0
+ */
+uint64 vm_translate(pgtbl_t table, uint64 virt_addr)
+{
+    int level;
+    pte_t *pte = vm_walk(table, virt_addr, false, 0, &level);
+    if (pte == NULL || !(*pte & PTE_V))
+        return 0;
+    return PTE_TO_PA(*pte) + (virt_addr & (LEVEL_PGSIZE(level) - 1));
+}
+
+/*
+ * 页表被修改后刷新TLB中相关的表项
+ * 只需要处理当前进程的用户页表: 内核页表在启动后不再变化,
+ * 尚未运行过的进程(例如fork中的子进程)和已经退出的进程不会使用这些表项
+ */
+void vm_flush(pgtbl_t table, uint64 virt_addr, uint64 len)
+{
+    proc_t *p = myproc();
+    if (table != NULL && table != kern_pagetable && p != NULL && p->pgtbl == table)
+        asid_flush(p, virt_addr, len);
+}
+
+// 内部辅助函数：检查一个页表页是否已经没有任何PTE (包括换出项)
+static bool pgtbl_empty(pgtbl_t table)
+{
+    for (int i = 0; i < 512; i++)
+        if (table[i] != 0) // 换出项(PTE_SWAP)虽然无效, 也要保留所在的页表
+            return false;
+    return true;
+}
+
+/*
+ * 把覆盖 virt_addr 的大页拆成512个4KB的叶子, 权限不变
+ * 用户大页(PTE_U)拥有对应的物理块, 同时把物理块拆成独立的单页, 以便之后逐页释放
+ * 与其他页表共享的用户大页复制成512个私有页面 (可能睡眠)
+ * 返回值: 成功(或者本来就不是大页)返回0, 内存不足返回-1
+ */
+int vm_split(pgtbl_t table, uint64 virt_addr)
+{
+    int level;
+    pte_t *entry = vm_getleaf(table, virt_addr, &level);
+    if (entry == NULL || !(*entry & PTE_V) || level == 0)
+        return 0;
+    if (level != 1)
+        panic("vm_split: unsupported level");
+
+    pgtbl_t child = (pgtbl_t)pmem_alloc(true);
+    if (child == NULL)
+        return -1;
+
+    uint64 pa = PTE_TO_PA(*entry);
+    int flags = PTE_FLAGS(*entry);
+
+    // fork 之后写时复制共享的用户大页不能拆分物理块: 复制出512个私有页面, 再放弃对大页的引用
+    if ((flags & PTE_U) && pmem_refcnt(pa) > 1) {
+        for (int i = 0; i < 512; i++) {
+            void *mem = pmem_alloc_flags(false, 0);
+            if (mem == NULL) {
+                for (int j = 0; j < i; j++)
+                    pmem_free(PTE_TO_PA(child[j]), false);
+                pmem_free((uint64)child, true);
+                return -1;
+            }
+            memmove(mem, (void *)(pa + (uint64)i * PGSIZE), PGSIZE);
+            child[i] = PA_TO_PTE((uint64)mem) | flags;
+        }
+        *entry = PA_TO_PTE((uint64)child) | PTE_V;
+        vm_flush(table, ALIGN_DOWN(virt_addr, MEGA_PGSIZE), MEGA_PGSIZE);
+        pmem_free_order(pa, 9, false);
+        return 0;
+    }
+
+    for (int i = 0; i < 512; i++)
+        child[i] = PA_TO_PTE(pa + (uint64)i * PGSIZE) | flags;
+
+    if (flags & PTE_U)
+        pmem_split_order(pa, 9);
+    *entry = PA_TO_PTE((uint64)child) | PTE_V;
+    vm_flush(table, ALIGN_DOWN(virt_addr, MEGA_PGSIZE), MEGA_PGSIZE);
+
+    return 0;
+}
+
+/*
+ * 检查 virt_addr 所在的2MB对齐块能否直接放入一个大页:
+ * 对应的第1级PTE无效, 或者指向一个已经没有任何映射的页表页
+ */
+bool vm_mega_slot_free(pgtbl_t table, uint64 virt_addr)
+{
+    pte_t *entry = vm_walk(table, virt_addr, false, 1, NULL);
+    if (entry == NULL || !(*entry & PTE_V))
+        return true;
+    return PTE_CHECK(*entry) && pgtbl_empty((pgtbl_t)PTE_TO_PA(*entry));
+}
+
+/*
+ * 内部辅助函数: 将虚拟地址区间 [virt_addr, virt_addr + len) 映射到物理地址 [phys_addr, phys_addr + len)
+ * 按低级页表为单位推进: 每张低级页表只从根向下走一次, 随后连续填写其中的PTE
+ * mega 为 true 时, 虚拟地址和物理地址都按2MB对齐且剩余长度足够的部分直接在次级页表放置大页
+ * 返回值: 成功返回0, 页表页申请失败返回-1
  */
-void vm_mappages(pgtbl_t table, uint64 virt_addr, uint64 phys_addr, uint64 len, int perm)
+static int vm_map_range(pgtbl_t table, uint64 virt_addr, uint64 phys_addr, uint64 len, int perm, bool mega)
 {
     // 确保地址页对齐
     if (virt_addr % PGSIZE != 0) panic("vm_mappages: virt_addr not aligned");
@@ -62,73 +189,159 @@ void vm_mappages(pgtbl_t table, uint64 virt_addr, uint64 phys_addr, uint64 len,
     uint64 last_addr = virt_addr + len - 1;
     if (last_addr >= VA_MAX) panic("vm_mappages: address overflow");
 
-    // 逐页建立映射
+    uint64 end = ALIGN_DOWN(last_addr, PGSIZE) + PGSIZE;
     uint64 curr_v = virt_addr;
     uint64 curr_p = phys_addr;
     
-    while (true) {
-        // 获取或创建 PTE
-        pte_t *entry = vm_getpte(table, curr_v, true);
+    while (curr_v < end) {
+        pte_t *entry;
+
+        if (mega && curr_v % MEGA_PGSIZE == 0 && curr_p % MEGA_PGSIZE == 0 && end - curr_v >= MEGA_PGSIZE) {
+            entry = vm_walk(table, curr_v, true, 1, NULL);
+            if (entry == NULL)
+                return -1;
+
+            // 大页的位置上已经有下一级页表: 空页表可以回收, 否则退回逐页映射
+            bool use_mega = true;
+            if ((*entry & PTE_V) && PTE_CHECK(*entry)) {
+                pgtbl_t child = (pgtbl_t)PTE_TO_PA(*entry);
+                if (pgtbl_empty(child)) {
+                    *entry = 0;
+                    pmem_free((uint64)child, true);
+                } else {
+                    use_mega = false;
+                }
+            } else if (*entry & PTE_V) {
+                panic("vm_mappages: remap");
+            }
+
+            if (use_mega) {
+                *entry = PA_TO_PTE(curr_p) | perm | PTE_V;
+                curr_v += MEGA_PGSIZE;
+                curr_p += MEGA_PGSIZE;
+                continue;
+            }
+        }
+
+        // 页表页申请失败, 或者被已有的大页覆盖: 已经建立的映射由调用者负责撤销
+        entry = vm_walk(table, curr_v, true, 0, NULL);
         if (entry == NULL) 
-            panic("vm_mappages: failed to get pte");
-        
-        // 如果该位置已经被映射且有效，通常不应重复映射（除非用于修改权限）
-        // 这里我们直接覆盖，或者可以加一个检查
-        if (*entry & PTE_V) {
-            // 允许覆盖映射，更新权限或物理地址
-            *entry = PA_TO_PTE(curr_p) | perm | PTE_V;
-        } else {
-            // 新增映射
+            return -1;
+
+        // 一直填写到这张低级页表的末尾 (下一张页表的起点才可能放置大页)
+        uint64 stop = MIN(end, ALIGN_DOWN(curr_v, MEGA_PGSIZE) + MEGA_PGSIZE);
+        for (; curr_v < stop; curr_v += PGSIZE, curr_p += PGSIZE, entry++) {
+            // 已经有效的映射不允许被覆盖 (修改映射应当先解除)
+            if (*entry & PTE_V)
+                panic("vm_mappages: remap");
             *entry = PA_TO_PTE(curr_p) | perm | PTE_V;
         }
+    }
 
-        // 检查是否处理完所有页面
-        if (curr_v == last_addr - (last_addr % PGSIZE))
-            break;
-        
-        curr_v += PGSIZE;
-        curr_p += PGSIZE;
-        
-        // 简单的边界保护，防止回绕
-        if (curr_v < virt_addr) break; 
+    // RISC-V允许TLB缓存无效的表项, 新建的映射同样需要刷新
+    vm_flush(table, virt_addr, end - virt_addr);
+    return 0;
+}
+
+/*
+ * 建立内存映射：将虚拟地址区间 [virt_addr, virt_addr + len) 
+ * 映射到物理地址 [phys_addr, phys_addr + len)
+ * 权限位由 perm 指定, 只使用4KB页面
+ * 返回值: 成功返回0, 页表页申请失败返回-1
+ */
+int vm_mappages(pgtbl_t table, uint64 virt_addr, uint64 phys_addr, uint64 len, int perm)
+{
+    return vm_map_range(table, virt_addr, phys_addr, len, perm, false);
+}
+
+/*
+ * 与 vm_mappages 相同, 但按2MB对齐且足够长的部分使用大页
+ * 只用于内核的直接映射和用户的透明大页: 用户大页解除映射时按一个 order 9 的块归还,
+ * 因此用户页表中的大页必须来自 pmem_alloc_order(9, false)
+ */
+int vm_mappages_mega(pgtbl_t table, uint64 virt_addr, uint64 phys_addr, uint64 len, int perm)
+{
+    return vm_map_range(table, virt_addr, phys_addr, len, perm, true);
+}
+
+/*
+ * 内部辅助函数: 解除第 level 级页表 table 中 [begin, end) 部分的映射
+ * 只进入存在的下一级页表, 缺失的子树整块跳过
+ * free_table 为 true 时回收被清空的下一级页表页, 通过 freed 报告是否发生过回收
+ * 返回值: table 是否已经没有任何有效的PTE
+ */
+static bool vm_unmap_range(pgtbl_t table, int level, uint64 begin, uint64 end,
+                           bool do_free, bool free_table, bool *freed)
+{
+    uint64 size = LEVEL_PGSIZE(level);
+    uint64 curr = begin;
+
+    for (uint64 idx = VA_TO_VPN(begin, level); idx < 512 && curr < end; idx++) {
+        uint64 next = ALIGN_DOWN(curr, size) + size;
+        uint64 stop = MIN(next, end);
+        pte_t *entry = &table[idx];
+
+        if (!(*entry & PTE_V)) {
+            // 换出到磁盘的页面: 释放时归还交换槽位, 否则本来就没有映射, 跳过
+            if (level == 0 && (*entry & PTE_SWAP)) {
+                if (do_free)
+                    swap_put(PTE_TO_SLOT(*entry));
+                *entry = 0;
+            }
+        } else if (level > 0 && PTE_CHECK(*entry)) {
+            pgtbl_t child = (pgtbl_t)PTE_TO_PA(*entry);
+            if (vm_unmap_range(child, level - 1, curr, stop, do_free, free_table, freed) && free_table) {
+                *entry = 0;
+                pmem_free((uint64)child, true);
+                *freed = true;
+            }
+        } else {
+            // 大页只能整体解除映射, 需要部分解除时调用者应先用 vm_split 拆分
+            if (curr % size != 0 || stop - curr != size)
+                panic("vm_unmappages: partial megapage");
+
+            // 如果需要回收物理内存
+            if (do_free) {
+                uint64 pa = PTE_TO_PA(*entry);
+                if (pa) pmem_free_order(pa, 9 * level, false); 
+            }
+
+            // 清空页表项
+            *entry = 0;
+        }
+        curr = next;
     }
+
+    return pgtbl_empty(table);
 }
 
 /*
- * 解除映射：移除虚拟地址区间 [virt_addr, virt_addr + len) 的映射
- * 如果 do_free 为 true，则同时释放对应的物理页
+ * 解除 [virt_addr, virt_addr + len) 的映射, do_free 为 true 时同时释放物理页
+ * 用户页表中被清空的中间页表页随之回收 (根页表除外)
+ * 内核页表的中间页表页被所有CPU共享, 不做回收
  */
 void vm_unmappages(pgtbl_t table, uint64 virt_addr, uint64 len, bool do_free)
 {
     if (virt_addr % PGSIZE != 0) panic("vm_unmappages: unaligned addr");
     if (len == 0) panic("vm_unmappages: zero length");
 
-    uint64 curr = virt_addr;
-    uint64 end = virt_addr + len; // 这里的end是开区间边界
+    uint64 last_addr = virt_addr + len - 1;
+    if (last_addr >= VA_MAX) panic("vm_unmappages: address overflow");
 
     // 向上取整处理len可能不对齐的情况
-    // 但逻辑上按照页遍历
-    for (; curr < end; curr += PGSIZE) {
-        pte_t *entry = vm_getpte(table, curr, false);
-        
-        // 如果PTE不存在或者无效，说明本来就没映射，跳过
-        if (entry == NULL || !(*entry & PTE_V))
-            continue;
-        
-        // [修复] 删除了错误的 Huge Page 检查
-        // vm_getpte 返回的是 Level 0 的 PTE。
-        // 有效的 Level 0 PTE *必须* 带有权限位（即 PTE_CHECK(*entry) == false）。
-        // 之前的代码在这里 panic 是错误的。
-
-        // 如果需要回收物理内存
-        if (do_free) {
-            uint64 pa = PTE_TO_PA(*entry);
-            if (pa) pmem_free(pa, false); 
-        }
-        
-        // 清空页表项
-        *entry = 0;
-    }
+    uint64 end = ALIGN_DOWN(last_addr, PGSIZE) + PGSIZE;
+
+    if (table == NULL)
+        table = kern_pagetable;
+    bool freed = false;
+    vm_unmap_range(table, 2, virt_addr, end, do_free, table != kern_pagetable, &freed);
+
+    // 按ASID和虚拟地址刷新被解除的映射
+    // 回收了中间页表页时, 按地址的刷新不保证清除缓存的非叶子表项, 需要刷新整个ASID
+    if (freed)
+        vm_flush(table, 0, VA_MAX);
+    else
+        vm_flush(table, virt_addr, end - virt_addr);
 }
 
 /*
@@ -148,43 +361,34 @@ void kvm_init()
     vm_mappages(kern_pagetable, CLINT_BASE, CLINT_BASE, 0x10000, PTE_R | PTE_W);
 
     // 4. 映射 PLIC 中断控制器 (读写)
-    vm_mappages(kern_pagetable, PLIC_BASE, PLIC_BASE, 0x400000, PTE_R | PTE_W);
+    vm_mappages_mega(kern_pagetable, PLIC_BASE, PLIC_BASE, 0x400000, PTE_R | PTE_W);
     vm_mappages(kern_pagetable, VIRTIO_BASE, VIRTIO_BASE, PGSIZE, PTE_R | PTE_W);
     // 5. 映射内核代码段 (读执行 PTE_R | PTE_X)
     // 范围: KERNEL_BASE ~ KERNEL_DATA (不含)
     uint64 code_len = (uint64)KERNEL_DATA - KERNEL_BASE;
-    vm_mappages(kern_pagetable, KERNEL_BASE, KERNEL_BASE, code_len, PTE_R | PTE_X);
+    vm_mappages_mega(kern_pagetable, KERNEL_BASE, KERNEL_BASE, code_len, PTE_R | PTE_X);
 
     // 6. 映射内核数据段 (读写 PTE_R | PTE_W)
     // 范围: KERNEL_DATA ~ ALLOC_BEGIN
     uint64 data_len = (uint64)ALLOC_BEGIN - (uint64)KERNEL_DATA;
-    vm_mappages(kern_pagetable, (uint64)KERNEL_DATA, (uint64)KERNEL_DATA, data_len, PTE_R | PTE_W);
+    vm_mappages_mega(kern_pagetable, (uint64)KERNEL_DATA, (uint64)KERNEL_DATA, data_len, PTE_R | PTE_W);
 
     // 7. 映射动态内存分配区域 (读写 PTE_R | PTE_W)
     // 范围: ALLOC_BEGIN ~ ALLOC_END
     uint64 free_mem_len = (uint64)ALLOC_END - (uint64)ALLOC_BEGIN;
-    vm_mappages(kern_pagetable, (uint64)ALLOC_BEGIN, (uint64)ALLOC_BEGIN, free_mem_len, PTE_R | PTE_W);
+    vm_mappages_mega(kern_pagetable, (uint64)ALLOC_BEGIN, (uint64)ALLOC_BEGIN, free_mem_len, PTE_R | PTE_W);
 
     // 8. 映射 Trampoline 跳板页 (读执行 PTE_R | PTE_X)
     // 必须映射到虚拟地址的最高处 TRAMPOLINE
     extern char trampoline[];
     vm_mappages(kern_pagetable, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
 
-    // 9. 映射所有进程的内核栈
+    // 9. 映射所有进程的内核栈 (每个内核栈是2个物理连续的页面)
     for (int i = 0; i < N_PROC; i++) {
-        // 页 1
-        void *stack_p1 = pmem_alloc(false);
-        if (!stack_p1) panic("kvm_init: alloc kstack page 1 failed");
-        // 页 2
-        void *stack_p2 = pmem_alloc(false);
-        if (!stack_p2) panic("kvm_init: alloc kstack page 2 failed");
-
-        uint64 kstack_va_base = KSTACK(i);
-        
-        // 映射低地址页
-        vm_mappages(kern_pagetable, kstack_va_base, (uint64)stack_p1, PGSIZE, PTE_R | PTE_W);
-        // 映射高地址页
-        vm_mappages(kern_pagetable, kstack_va_base + PGSIZE, (uint64)stack_p2, PGSIZE, PTE_R | PTE_W);
+        void *stack_mem = pmem_alloc_order(1, false);
+        if (!stack_mem) panic("kvm_init: alloc kstack failed");
+
+        vm_mappages(kern_pagetable, KSTACK(i), (uint64)stack_mem, 2 * PGSIZE, PTE_R | PTE_W);
     }
 }
 
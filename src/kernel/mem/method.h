@@ -1,15 +1,33 @@
 #pragma once
 
+struct proc;
+
 /* pmem.c: 物理内存管理逻辑 */
 
 void pmem_init(void);
 void *pmem_alloc(bool in_kernel);
+void *pmem_alloc_flags(bool in_kernel, uint32 flags);
 void pmem_free(uint64 page, bool in_kernel);
+void pmem_get(uint64 page);
+uint32 pmem_refcnt(uint64 page);
+void *pmem_alloc_order(uint32 order, bool in_kernel);
+void pmem_free_order(uint64 page, uint32 order, bool in_kernel);
+void pmem_split_order(uint64 page, uint32 order);
+uint32 pmem_free_blocks(uint32 order, bool in_kernel);
+void pmem_idle_zero();
+void pmem_register_reclaim(reclaim_fn_t fn);
+void pmem_stat();
 
 /* kvm.c: 内核态虚拟内存管理 + 页表通用函数 */
 
 pte_t *vm_getpte(pgtbl_t pgtbl, uint64 va, bool alloc);
-void vm_mappages(pgtbl_t pgtbl, uint64 va, uint64 pa, uint64 len, int perm);
+pte_t *vm_getleaf(pgtbl_t pgtbl, uint64 va, int *level);
+uint64 vm_translate(pgtbl_t pgtbl, uint64 va);
+int vm_split(pgtbl_t pgtbl, uint64 va);
+bool vm_mega_slot_free(pgtbl_t pgtbl, uint64 va);
+void vm_flush(pgtbl_t pgtbl, uint64 va, uint64 len);
+int vm_mappages(pgtbl_t pgtbl, uint64 va, uint64 pa, uint64 len, int perm);
+int vm_mappages_mega(pgtbl_t pgtbl, uint64 va, uint64 pa, uint64 len, int perm);
 void vm_unmappages(pgtbl_t pgtbl, uint64 va, uint64 len, bool freeit);
 void vm_print(pgtbl_t pgtbl);
 void kvm_init();
@@ -20,18 +38,66 @@ void kvm_inithart();
 void uvm_copyin(pgtbl_t pgtbl, uint64 dst, uint64 src, uint32 len);
 void uvm_copyout(pgtbl_t pgtbl, uint64 dst, uint64 src, uint32 len);
 void uvm_copyin_str(pgtbl_t pgtbl, uint64 dst, uint64 src, uint32 maxlen);
+#ifdef MEM_BENCH
+void uvm_copy_bench();
+#endif
 void uvm_show_mmaplist(mmap_region_t *mmap);
-void uvm_mmap(uint64 begin, uint32 npages, int perm);
-void uvm_munmap(uint64 begin, uint32 npages);
-uint64 uvm_heap_grow(pgtbl_t pgtbl, uint64 cur_heap_top, uint32 len);
+uint64 uvm_mmap(uint64 begin, uint32 npages, int perm, bool populate);
+uint64 uvm_mmap_shared(uint64 begin, uint32 npages, uint64 *pages);
+int uvm_munmap(uint64 begin, uint32 npages);
+uint64 uvm_heap_grow(pgtbl_t pgtbl, uint64 cur_heap_top, uint32 len, bool populate);
 uint64 uvm_heap_ungrow(pgtbl_t pgtbl, uint64 cur_heap_top, uint32 len);
 uint64 uvm_ustack_grow(pgtbl_t pgtbl, uint64 old_ustack_npage, uint64 fault_addr);
 void uvm_destroy_pgtbl(pgtbl_t pgtbl);
-void uvm_copy_pgtbl(pgtbl_t old, pgtbl_t new, uint64 heap_top, uint64 ustack_npage, mmap_region_t *mmap);
+int uvm_copy_pgtbl(pgtbl_t old, pgtbl_t new, uint64 heap_top, uint64 ustack_npage, mmap_region_t *mmap);
+int uvm_cow(pgtbl_t pgtbl, uint64 va);
+int uvm_fault(struct proc *p, uint64 va, bool is_write);
+void uvm_fault_stat(struct proc *p);
+uint64 uvm_next_private_va(struct proc *p, uint64 va);
+
+/* asid.c: 用户地址空间的ASID管理 */
+
+void asid_init();
+uint64 asid_activate(struct proc *p);
+void asid_flush(struct proc *p, uint64 va, uint64 len);
 
-/* mmap.c: mmap_node仓库管理 */
+/* kmalloc.c: 小型内核对象分配 */
+
+void kmalloc_init();
+void *kmalloc(uint32 size);
+void kfree(void *ptr);
+void kmalloc_stat();
+
+/* mmap.c: mmap_region的申请与释放, mmap区域树 */
 
 void mmap_init();
 mmap_region_t *mmap_region_alloc();
 void mmap_region_free(mmap_region_t *mmap);
 void mmap_show_nodelist();
+void mmap_tree_insert(mmap_region_t **root, mmap_region_t *node);
+void mmap_tree_remove(mmap_region_t **root, mmap_region_t *node);
+mmap_region_t *mmap_tree_find(mmap_region_t *root, uint64 va);
+uint64 mmap_tree_gap(mmap_region_t *root, uint64 len);
+int mmap_tree_copy(mmap_region_t *src, mmap_region_t **dst);
+void mmap_tree_free(mmap_region_t *root);
+
+/* shm.c: 共享内存对象 */
+
+void shm_init();
+int shm_create(uint32 npages);
+uint64 shm_map(int id, uint64 start);
+int shm_destroy(int id);
+
+/* ksm.c: 相同页面合并 */
+
+void ksm_init();
+void ksm_scan();
+void ksm_stat();
+
+/* swap.c: 匿名页面的换出与换入 */
+
+void swap_init();
+int swap_in(struct proc *p, uint64 va);
+void swap_dup(uint32 slot);
+void swap_put(uint32 slot);
+void swap_stat();
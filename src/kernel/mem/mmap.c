@@ -1,99 +1,293 @@
 #include "mod.h"
 
-/* * 管理 mmap_region 结构体的内存池
- * 我们预先分配 N_MMAP 个节点，并通过单向链表维护空闲节点
+/*
+ * 管理 mmap_region 结构体的分配
+ * 节点由 kmalloc 按需申请，数量随负载增长，不再受固定大小的节点池限制
  */
-static mmap_region_node_t region_pool[N_MMAP];  // 静态节点池
-static mmap_region_node_t pool_sentinel;        // 链表哨兵节点（头节点）
-static spinlock_t pool_lock;                    // 保护内存池的自旋锁
+static int nr_regions;       // 正在使用的节点数量
+static spinlock_t count_lock; // 保护 nr_regions
 
-// 初始化 mmap 区域分配器
+// 初始化 mmap 区域分配器 (需要在kmalloc_init之后调用)
 void mmap_init()
 {
-    // 初始化锁，用于保护空闲链表
-    spinlock_init(&pool_lock, "mmap_allocator");
+    spinlock_init(&count_lock, "mmap_allocator");
+    nr_regions = 0;
+}
 
-    spinlock_acquire(&pool_lock);
+// 申请一个 mmap_region 结构体
+// 如果内核内存耗尽，则返回 NULL
+mmap_region_t *mmap_region_alloc()
+{
+    mmap_region_t *mmap = (mmap_region_t *)kmalloc(sizeof(mmap_region_t));
+    if (mmap == NULL)
+        return NULL;
 
-    // 将所有静态节点串联成空闲链表
-    // 哨兵节点的 next 指向数组的第一个元素
-    pool_sentinel.next = &region_pool[0];
+    spinlock_acquire(&count_lock);
+    nr_regions++;
+    spinlock_release(&count_lock);
 
-    // 遍历数组，将当前节点的 next 指向下一个节点
-    for (int i = 0; i < N_MMAP - 1; i++) {
-        region_pool[i].next = &region_pool[i + 1];
-    }
-    
-    // 最后一个节点的 next 设为 NULL，表示链表结束
-    region_pool[N_MMAP - 1].next = NULL;
+    // 初始化节点数据，防止脏数据残留
+    mmap->begin = 0;
+    mmap->npages = 0;
+    mmap->perm = 0;
+    mmap->shared = false;
+    mmap->left = NULL;
+    mmap->right = NULL;
+    mmap->height = 1;
+    mmap->tree_begin = 0;
+    mmap->tree_end = 0;
+    mmap->max_gap = 0;
 
-    spinlock_release(&pool_lock);
+    return mmap;
 }
 
-// 从内存池中分配一个 mmap_region 结构体
-// 如果没有空闲节点，则触发 panic
-mmap_region_t *mmap_region_alloc()
+// 将不再使用的 mmap_region 结构体归还给 kmalloc
+void mmap_region_free(mmap_region_t *mmap)
+{
+    if (mmap == NULL)
+        return;
+
+    spinlock_acquire(&count_lock);
+    nr_regions--;
+    spinlock_release(&count_lock);
+
+    kfree(mmap);
+}
+
+// 调试辅助函数：打印 mmap_region 的使用情况
+void mmap_show_nodelist()
+{
+    spinlock_acquire(&count_lock);
+    printf("--- MMAP Region Nodes ---\n");
+    printf("Total nodes in use: %d (%d bytes each)\n", nr_regions, (int)sizeof(mmap_region_t));
+    spinlock_release(&count_lock);
+
+    kmalloc_stat();
+}
+
+/* -------------------------------------------------------------------------
+ * mmap区域树: 以 begin 为键的AVL树, 节点上维护子树的地址范围和最大空隙
+ * 树属于单个进程, 只由该进程自己(或者持有其锁的fork/回收路径)修改, 不需要额外加锁
+ * ------------------------------------------------------------------------- */
+
+#define TREE_HEIGHT(n) ((n) ? (n)->height : 0)
+
+// 根据左右子树重新计算节点的高度和附加信息
+static void tree_update(mmap_region_t *n)
+{
+    uint64 end = MMAP_REGION_END(n);
+
+    n->height = MAX(TREE_HEIGHT(n->left), TREE_HEIGHT(n->right)) + 1;
+    n->tree_begin = n->left ? n->left->tree_begin : n->begin;
+    n->tree_end = n->right ? n->right->tree_end : end;
+    n->max_gap = 0;
+    if (n->left)
+        n->max_gap = MAX(n->left->max_gap, n->begin - n->left->tree_end);
+    if (n->right)
+        n->max_gap = MAX(n->max_gap, MAX(n->right->max_gap, n->right->tree_begin - end));
+}
+
+static mmap_region_t *tree_rotate_left(mmap_region_t *n)
+{
+    mmap_region_t *r = n->right;
+    n->right = r->left;
+    r->left = n;
+    tree_update(n);
+    tree_update(r);
+    return r;
+}
+
+static mmap_region_t *tree_rotate_right(mmap_region_t *n)
+{
+    mmap_region_t *l = n->left;
+    n->left = l->right;
+    l->right = n;
+    tree_update(n);
+    tree_update(l);
+    return l;
+}
+
+// 更新节点并在左右子树高度差超过1时旋转, 返回子树新的根
+static mmap_region_t *tree_balance(mmap_region_t *n)
 {
-    spinlock_acquire(&pool_lock);
+    tree_update(n);
+    int bf = TREE_HEIGHT(n->left) - TREE_HEIGHT(n->right);
 
-    // 从链表头获取第一个空闲节点
-    mmap_region_node_t *free_node = pool_sentinel.next;
-    
-    if (free_node == NULL) {
-        // 资源耗尽，无法恢复
-        spinlock_release(&pool_lock);
-        panic("mmap_region_alloc: run out of mmap nodes");
+    if (bf > 1) {
+        if (TREE_HEIGHT(n->left->left) < TREE_HEIGHT(n->left->right))
+            n->left = tree_rotate_left(n->left);
+        return tree_rotate_right(n);
     }
+    if (bf < -1) {
+        if (TREE_HEIGHT(n->right->right) < TREE_HEIGHT(n->right->left))
+            n->right = tree_rotate_right(n->right);
+        return tree_rotate_left(n);
+    }
+    return n;
+}
 
-    // 将头指针移动到下一个节点，完成节点摘除
-    pool_sentinel.next = free_node->next;
+static mmap_region_t *tree_insert(mmap_region_t *n, mmap_region_t *node)
+{
+    if (n == NULL)
+        return node;
+    if (node->begin < n->begin)
+        n->left = tree_insert(n->left, node);
+    else if (node->begin > n->begin)
+        n->right = tree_insert(n->right, node);
+    else
+        panic("mmap_tree_insert: duplicate region");
+    return tree_balance(n);
+}
 
-    spinlock_release(&pool_lock);
+// 从子树中摘下最左侧的节点, 通过 min 返回
+static mmap_region_t *tree_remove_min(mmap_region_t *n, mmap_region_t **min)
+{
+    if (n->left == NULL) {
+        *min = n;
+        return n->right;
+    }
+    n->left = tree_remove_min(n->left, min);
+    return tree_balance(n);
+}
 
-    // 初始化节点数据，防止脏数据残留
-    // 注意：虽然这里返回的是 mmap_region_t 指针，但其实质是 node 的第一个成员
-    free_node->mmap.begin = 0;
-    free_node->mmap.npages = 0;
-    free_node->mmap.next = NULL;
+static mmap_region_t *tree_remove(mmap_region_t *n, mmap_region_t *node)
+{
+    if (n == NULL)
+        panic("mmap_tree_remove: region not found");
 
-    return &free_node->mmap;
+    if (node->begin < n->begin) {
+        n->left = tree_remove(n->left, node);
+    } else if (node->begin > n->begin) {
+        n->right = tree_remove(n->right, node);
+    } else {
+        if (n != node)
+            panic("mmap_tree_remove: region mismatch");
+        if (n->left == NULL || n->right == NULL)
+            return n->left ? n->left : n->right;
+
+        // 用右子树中的最小节点顶替被删除的节点
+        mmap_region_t *succ;
+        mmap_region_t *right = tree_remove_min(n->right, &succ);
+        succ->left = n->left;
+        succ->right = right;
+        n = succ;
+    }
+    return tree_balance(n);
 }
 
-// 将不再使用的 mmap_region 结构体归还给内存池
-void mmap_region_free(mmap_region_t *mmap)
+/*
+ * 把节点插入区域树 (节点必须已经设置好 begin 和 npages, 且不与已有区域重叠)
+ * 修改节点的 begin 或 npages 之前必须先把它从树中删除, 修改后再重新插入
+ */
+void mmap_tree_insert(mmap_region_t **root, mmap_region_t *node)
 {
-    if (mmap == NULL)
-        return;
+    node->left = NULL;
+    node->right = NULL;
+    tree_update(node);
+    *root = tree_insert(*root, node);
+}
 
-    // 强转回节点类型
-    mmap_region_node_t *node_to_free = (mmap_region_node_t *)mmap;
+// 把节点从区域树中删除 (不释放节点)
+void mmap_tree_remove(mmap_region_t **root, mmap_region_t *node)
+{
+    *root = tree_remove(*root, node);
+    node->left = NULL;
+    node->right = NULL;
+}
 
-    spinlock_acquire(&pool_lock);
+/*
+ * 查找结束地址大于 va 的第一个区域
+ * 如果有区域包含 va 则返回该区域, 否则返回 va 之后的第一个区域, 都没有时返回NULL
+ * 按地址顺序遍历所有区域: for (m = find(root, 0); m; m = find(root, MMAP_REGION_END(m)))
+ */
+mmap_region_t *mmap_tree_find(mmap_region_t *root, uint64 va)
+{
+    mmap_region_t *ret = NULL;
+    while (root) {
+        if (MMAP_REGION_END(root) > va) {
+            ret = root;
+            root = root->left;
+        } else {
+            root = root->right;
+        }
+    }
+    return ret;
+}
 
-    // 头插法：将归还的节点插入到链表头部
-    node_to_free->next = pool_sentinel.next;
-    pool_sentinel.next = node_to_free;
+/*
+ * 内部辅助函数: 在子树 n 之前 (从 lo 开始) 以及子树内部寻找最低的长度不小于 len 的空隙
+ * lo 是子树前驱区域的结束地址, 返回空隙起点, 没有时返回0
+ * 不满足条件的子树只需要 O(1) 就能排除, 因此整体只会沿一条路径向下
+ */
+static uint64 tree_gap(mmap_region_t *n, uint64 lo, uint64 len)
+{
+    if (n == NULL)
+        return 0;
+    if (n->tree_begin - lo >= len)
+        return lo;
+    if (n->max_gap < len)
+        return 0;
+
+    uint64 addr = tree_gap(n->left, lo, len);
+    if (addr != 0)
+        return addr;
 
-    spinlock_release(&pool_lock);
+    uint64 prev_end = n->left ? n->left->tree_end : lo;
+    if (n->begin - prev_end >= len)
+        return prev_end;
+
+    return tree_gap(n->right, MMAP_REGION_END(n), len);
 }
 
-// 调试辅助函数：打印当前内存池中的空闲节点链表
-void mmap_show_nodelist()
+/*
+ * 在 [MMAP_BEGIN, MMAP_END) 中寻找最低的长度不小于 len 字节的空闲地址范围
+ * 返回起始地址, 没有足够的空间时返回0
+ */
+uint64 mmap_tree_gap(mmap_region_t *root, uint64 len)
 {
-    spinlock_acquire(&pool_lock);
-
-    printf("--- MMAP Free Node List ---\n");
-    mmap_region_node_t *curr = pool_sentinel.next;
-    int count = 0;
-    
-    while (curr != NULL) {
-        // 计算当前节点在数组中的索引
-        // 利用指针减法计算偏移量
-        int index = (int)(curr - &region_pool[0]);
-        printf("Free Node #%d: Pool Index = %d, Addr = %p\n", count++, index, curr);
-        curr = curr->next;
+    if (root == NULL)
+        return (len <= MMAP_END - MMAP_BEGIN) ? MMAP_BEGIN : 0;
+
+    uint64 addr = tree_gap(root, MMAP_BEGIN, len);
+    if (addr != 0)
+        return addr;
+    if (MMAP_END - root->tree_end >= len)
+        return root->tree_end;
+    return 0;
+}
+
+/*
+ * 复制整棵区域树 (fork使用), 结构和附加信息保持不变
+ * 返回值: 成功返回0, 内存不足返回-1 (此时已经复制的节点全部释放, *dst 为NULL)
+ */
+int mmap_tree_copy(mmap_region_t *src, mmap_region_t **dst)
+{
+    *dst = NULL;
+    if (src == NULL)
+        return 0;
+
+    mmap_region_t *node = mmap_region_alloc();
+    if (node == NULL)
+        return -1;
+    *node = *src;
+    node->left = NULL;
+    node->right = NULL;
+
+    if (mmap_tree_copy(src->left, &node->left) < 0 ||
+        mmap_tree_copy(src->right, &node->right) < 0) {
+        mmap_tree_free(node);
+        return -1;
     }
-    printf("Total free nodes: %d\n", count);
+    *dst = node;
+    return 0;
+}
 
-    spinlock_release(&pool_lock);
-}
\ No newline at end of file
+// 释放整棵区域树的所有节点 (不处理页表)
+void mmap_tree_free(mmap_region_t *root)
+{
+    if (root == NULL)
+        return;
+    mmap_tree_free(root->left);
+    mmap_tree_free(root->right);
+    mmap_region_free(root);
+}
@@ -5,6 +5,171 @@
 static alloc_region_t kernel_pool;
 static alloc_region_t user_pool;
 
+// 每个CPU对两个内存池各有一个本地页面缓存: [cpuid][in_kernel]
+static page_cache_t page_caches[NCPU][2];
+
+// 回收时请求其他CPU归还本地缓存 (本地缓存只能由所属CPU访问, 由它在下一次操作缓存时处理)
+static volatile bool drain_req[NCPU];
+
+// 所有物理页的描述符
+static page_t pages[N_PHYS_PAGES];
+
+// 每个chunk当前所属的区域 (POOL_NONE/POOL_KERNEL/POOL_USER)
+static uint8 chunk_owner[N_CHUNKS];
+
+// 内存紧张时的回收链 (只在初始化阶段注册, 之后只读)
+static reclaim_fn_t reclaim_chain[N_RECLAIM];
+static int nr_reclaim;
+
+// 回收与分配失败的统计信息
+static spinlock_t reclaim_lk;
+static uint32 reclaim_runs;   // 运行回收链的次数
+static uint32 reclaim_pages;  // 回收链释放的页面总数
+static uint32 alloc_failed;   // 回收后仍然失败、返回NULL的次数
+
+// 物理地址 -> 描述符
+static inline page_t *pa_to_page(uint64 pa)
+{
+    return &pages[PA_TO_PFN(pa)];
+}
+
+// 计算伙伴块的物理地址: 页号的第order位取反
+static inline uint64 buddy_of(uint64 pa, uint32 order)
+{
+    return pa ^ ((uint64)PGSIZE << order);
+}
+
+/* --------------------------- 伙伴系统 (调用者需持有 pool->lk) --------------------------- */
+
+// 将一个空闲块挂入第order阶链表
+static void buddy_list_add(alloc_region_t *pool, uint64 pa, uint32 order)
+{
+    page_node_t *node = (page_node_t *)pa;
+    page_node_t *head = &pool->free_area[order];
+
+    node->next = head->next;
+    node->prev = head;
+    head->next->prev = node;
+    head->next = node;
+    pool->nr_free[order]++;
+
+    page_t *page = pa_to_page(pa);
+    page->flags |= PG_BUDDY;
+    page->order = order;
+}
+
+// 将一个空闲块从第order阶链表摘除
+static void buddy_list_del(alloc_region_t *pool, uint64 pa, uint32 order)
+{
+    page_node_t *node = (page_node_t *)pa;
+
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    pool->nr_free[order]--;
+
+    pa_to_page(pa)->flags &= ~PG_BUDDY;
+}
+
+static void buddy_free(alloc_region_t *pool, uint64 pa, uint32 order);
+
+// 将[start, end)切分成尽可能大的对齐块交给伙伴系统
+static void buddy_free_range(alloc_region_t *pool, uint64 start, uint64 end)
+{
+    uint64 addr = start;
+    while (addr < end) {
+        uint32 order = MAX_ORDER - 1;
+        while (order > 0 && ((addr & (((uint64)PGSIZE << order) - 1)) != 0 ||
+                             addr + ((uint64)PGSIZE << order) > end))
+            order--;
+        buddy_free(pool, addr, order);
+        addr += (uint64)PGSIZE << order;
+    }
+}
+
+/*
+ * 从前沿切出一个按2^order页对齐的块, 失败返回0
+ * 对齐产生的空隙挂入空闲链表; 切不出时把前沿剩余部分全部挂入空闲链表
+ * 前沿的页面已经计入allocable, 挂入空闲链表时需要先扣除, 避免重复计数
+ */
+static uint64 frontier_alloc(alloc_region_t *pool, uint32 order)
+{
+    uint64 size = (uint64)PGSIZE << order;
+    uint64 pa = ALIGN_UP(pool->frontier, size);
+    uint64 gap_end = (pa + size <= pool->end) ? pa : pool->end;
+
+    if (gap_end > pool->frontier) {
+        pool->allocable -= (gap_end - pool->frontier) / PGSIZE;
+        buddy_free_range(pool, pool->frontier, gap_end);
+        pool->frontier = gap_end;
+    }
+
+    if (pa + size > pool->end)
+        return 0;
+
+    pool->frontier = pa + size;
+    return pa;
+}
+
+// 从伙伴系统申请2^order个连续页面, 失败返回0
+static uint64 buddy_alloc(alloc_region_t *pool, uint32 order)
+{
+    // 寻找不小于order的最小非空链表
+    uint32 cur = order;
+    while (cur < MAX_ORDER && pool->nr_free[cur] == 0)
+        cur++;
+
+    // 空闲链表不够用时从前沿切块 (前沿的剩余部分可能被挂入空闲链表, 需要重新查找)
+    if (cur == MAX_ORDER && pool->frontier < pool->end) {
+        uint64 pa = frontier_alloc(pool, order);
+        if (pa != 0) {
+            pool->allocable -= (1u << order);
+            return pa;
+        }
+        cur = order;
+        while (cur < MAX_ORDER && pool->nr_free[cur] == 0)
+            cur++;
+    }
+    if (cur == MAX_ORDER)
+        return 0;
+
+    uint64 pa = (uint64)pool->free_area[cur].next;
+    buddy_list_del(pool, pa, cur);
+
+    // 逐级对半拆分, 把高地址的一半挂回低阶链表
+    while (cur > order) {
+        cur--;
+        buddy_list_add(pool, pa + ((uint64)PGSIZE << cur), cur);
+    }
+
+    pool->allocable -= (1u << order);
+    return pa;
+}
+
+// 向伙伴系统归还2^order个连续页面, 并尽可能与伙伴合并
+static void buddy_free(alloc_region_t *pool, uint64 pa, uint32 order)
+{
+    pool->allocable += (1u << order);
+
+    while (order < MAX_ORDER - 1) {
+        uint64 buddy = buddy_of(pa, order);
+
+        // 伙伴必须属于同一个区域, 且是同阶的空闲块
+        if (buddy < (uint64)ALLOC_BEGIN || buddy >= (uint64)ALLOC_END)
+            break;
+        if (chunk_owner[PA_TO_CHUNK(buddy)] != pool->id)
+            break;
+        page_t *bp = pa_to_page(buddy);
+        if (!(bp->flags & PG_BUDDY) || bp->order != order)
+            break;
+
+        buddy_list_del(pool, buddy, order);
+        pa = MIN(pa, buddy);
+        order++;
+    }
+
+    buddy_list_add(pool, pa, order);
+}
+
 /*
  * 内部辅助函数：初始化指定的内存池
  * pool: 目标内存池结构体
@@ -12,29 +177,30 @@ static alloc_region_t user_pool;
  * end: 物理内存结束地址
  * lock_name: 锁的名称
  */
-static void init_pool(alloc_region_t *pool, uint64 start, uint64 end, char *lock_name)
+static void init_pool(alloc_region_t *pool, uint8 id, uint64 start, uint64 end, char *lock_name)
 {
     pool->begin = start;
     pool->end = end;
-    pool->allocable = 0;
+    pool->id = id;
+    pool->borrowed = 0;
+    pool->lent = 0;
     
     // 初始化保护该池的自旋锁
     spinlock_init(&pool->lk, lock_name);
 
-    // 初始化空闲链表头（哨兵节点）
-    pool->list_head.next = NULL;
-
-    // 将地址范围内的所有物理页加入空闲链表
-    // 按照页大小步进，将每个页面的首地址强转为 page_node_t 并插入链表
-    for (uint64 addr = start; addr < end; addr += PGSIZE) {
-        page_node_t *node = (page_node_t *)addr;
-        
-        // 头插法：将新页面插入到 list_head 之后
-        node->next = pool->list_head.next;
-        pool->list_head.next = node;
-        
-        pool->allocable++;
+    // 初始化各阶空闲链表的头节点（哨兵节点）
+    for (int i = 0; i < MAX_ORDER; i++) {
+        pool->free_area[i].next = pool->free_area[i].prev = &pool->free_area[i];
+        pool->nr_free[i] = 0;
     }
+
+    // 登记区域拥有的chunk
+    for (uint64 addr = ALIGN_DOWN(start, CHUNK_SIZE); addr < end; addr += CHUNK_SIZE)
+        chunk_owner[PA_TO_CHUNK(addr)] = id;
+
+    // 整个区域都在前沿之后, 第一次分配时才会被切块, 这里不触碰任何页面
+    pool->frontier = start;
+    pool->allocable = (end - start) / PGSIZE;
 }
 
 /*
@@ -51,57 +217,275 @@ void pmem_init(void)
         panic("pmem_init: memory address not aligned");
     }
 
-    // 计算内核池的边界：起始地址 + 预留页数 * 页大小
-    uint64 kernel_pool_end = start_addr + (uint64)KERN_PAGES * PGSIZE;
+    // 计算内核池的边界：起始地址 + 预留页数 * 页大小 (向上对齐到chunk, 使每个chunk只属于一个区域)
+    uint64 kernel_pool_end = ALIGN_UP(start_addr + (uint64)KERN_PAGES * PGSIZE, CHUNK_SIZE);
     
     if (kernel_pool_end > end_addr) {
         panic("pmem_init: not enough memory");
     }
 
+    if (end_addr > KERNEL_BASE + PHYS_SIZE) {
+        panic("pmem_init: page descriptors not enough");
+    }
+
     // 分别初始化两个池
     // 内核池：ALLOC_BEGIN ~ KERNEL_POOL_END
-    init_pool(&kernel_pool, start_addr, kernel_pool_end, "kernel_pmem_lk");
+    init_pool(&kernel_pool, POOL_KERNEL, start_addr, kernel_pool_end, "kernel_pmem_lk");
     
     // 用户池：KERNEL_POOL_END ~ ALLOC_END
-    init_pool(&user_pool, kernel_pool_end, end_addr, "user_pmem_lk");
+    init_pool(&user_pool, POOL_USER, kernel_pool_end, end_addr, "user_pmem_lk");
+
+    spinlock_init(&reclaim_lk, "pmem_reclaim");
 }
 
 /*
- * 分配一个物理页
- * in_kernel: true 表示从内核池分配，false 表示从用户池分配
- * 返回值: 分配到的物理页的首地址（已清零）；如果耗尽则 panic
+ * 内部辅助函数：pool的伙伴系统耗尽时, 从另一个区域借入至少2^order个页面
+ * 借入的单位是完整的chunk, 借入后这些chunk永久归属pool (直到被对方借回)
+ * 调用者不能持有任何一个区域的锁
+ * 返回值: 是否借到了内存
  */
-void *pmem_alloc(bool in_kernel)
+static bool pool_borrow(alloc_region_t *pool, uint32 order)
+{
+    alloc_region_t *lender = (pool == &kernel_pool) ? &user_pool : &kernel_pool;
+    uint32 borrow_order = MAX(order, CHUNK_ORDER);
+
+    if (borrow_order >= MAX_ORDER)
+        return false;
+
+    // 从对方的伙伴系统取出一个按chunk对齐的块, 并转移其中所有chunk的归属
+    spinlock_acquire(&lender->lk);
+    uint64 pa = buddy_alloc(lender, borrow_order);
+    if (pa != 0) {
+        uint32 nchunks = 1u << (borrow_order - CHUNK_ORDER);
+        for (uint32 i = 0; i < nchunks; i++)
+            chunk_owner[PA_TO_CHUNK(pa) + i] = pool->id;
+        lender->lent += nchunks;
+    }
+    spinlock_release(&lender->lk);
+
+    if (pa == 0)
+        return false;
+
+    // 挂入自己的伙伴系统
+    spinlock_acquire(&pool->lk);
+    pool->borrowed += 1u << (borrow_order - CHUNK_ORDER);
+    buddy_free(pool, pa, borrow_order);
+    spinlock_release(&pool->lk);
+
+    return true;
+}
+
+/* --------------------------- CPU本地缓存 (调用者需关闭中断) --------------------------- */
+
+// 单向链表的头部插入与弹出
+static inline void cache_push(page_node_t *head, uint32 *count, uint64 pa)
+{
+    page_node_t *node = (page_node_t *)pa;
+    node->next = head->next;
+    head->next = node;
+    (*count)++;
+}
+
+static inline uint64 cache_pop(page_node_t *head, uint32 *count)
+{
+    page_node_t *node = head->next;
+    if (node == NULL)
+        return 0;
+    head->next = node->next;
+    (*count)--;
+    return (uint64)node;
+}
+
+// 从伙伴系统批量搬运单页到本地脏页链表
+static void cache_refill(alloc_region_t *pool, page_cache_t *cache)
+{
+    spinlock_acquire(&pool->lk);
+
+    for (int i = 0; i < PCP_BATCH; i++) {
+        uint64 pa = buddy_alloc(pool, 0);
+        if (pa == 0)
+            break;
+        cache_push(&cache->list_head, &cache->count, pa);
+    }
+    cache->refill++;
+
+    spinlock_release(&pool->lk);
+}
+
+// 从本地缓存批量归还单页到伙伴系统 (优先归还脏页, 保留预清零页面)
+static void cache_drain(alloc_region_t *pool, page_cache_t *cache)
+{
+    spinlock_acquire(&pool->lk);
+
+    for (int i = 0; i < PCP_BATCH; i++) {
+        uint64 pa = cache_pop(&cache->list_head, &cache->count);
+        if (pa == 0)
+            pa = cache_pop(&cache->zero_head, &cache->zero_count);
+        if (pa == 0)
+            break;
+        buddy_free(pool, pa, 0);
+    }
+    cache->drain++;
+
+    spinlock_release(&pool->lk);
+}
+
+// 内部辅助函数：把当前CPU的本地缓存全部归还伙伴系统 (调用者需关闭中断)
+static void cache_drain_all()
+{
+    for (int j = 0; j < 2; j++) {
+        alloc_region_t *pool = j ? &kernel_pool : &user_pool;
+        page_cache_t *cache = &page_caches[mycpuid()][j];
+        while (cache->count + cache->zero_count > 0)
+            cache_drain(pool, cache);
+    }
+    drain_req[mycpuid()] = false;
+}
+
+// 内部辅助函数：响应其他CPU的归还请求 (调用者需关闭中断)
+static inline void cache_check_drain()
+{
+    if (drain_req[mycpuid()])
+        cache_drain_all();
+}
+
+/*
+ * 内部辅助函数：运行回收链, 尽量释放target个页面
+ * 回收到的页面进入当前CPU的本地缓存, 回收后把本地缓存全部归还伙伴系统,
+ * 并请求其他CPU也归还各自的本地缓存, 使空闲页面有机会合并成完整的chunk供另一个区域借用
+ * 其他CPU在下一次操作本地缓存(或者空闲预清零)时异步响应, 这次分配仍然失败的调用者可以稍后重试
+ * 返回值: 实际回收的页面数 (不含其他CPU归还的缓存页面)
+ */
+static uint32 pmem_reclaim(uint32 target)
+{
+    uint32 freed = 0;
+
+    for (int i = 0; i < nr_reclaim && freed < target; i++)
+        freed += reclaim_chain[i](target - freed);
+
+    // 不等待其他CPU响应: 对方可能正关着中断等待本CPU持有的锁
+    push_off();
+    int self = mycpuid();
+    cache_drain_all();
+    for (int i = 0; i < NCPU; i++)
+        if (i != self)
+            drain_req[i] = true;
+    pop_off();
+
+    spinlock_acquire(&reclaim_lk);
+    reclaim_runs++;
+    reclaim_pages += freed;
+    spinlock_release(&reclaim_lk);
+
+    return freed;
+}
+
+// 内部辅助函数：记录一次最终失败的分配
+static void pmem_alloc_fail()
+{
+    spinlock_acquire(&reclaim_lk);
+    alloc_failed++;
+    spinlock_release(&reclaim_lk);
+}
+
+/*
+ * 内部辅助函数：从当前CPU的本地缓存取一个页面, 必要时补充或借用
+ * need_zero: 输出参数, 取到的是脏页但调用者需要全0页面时置为true
+ * 返回值: 页面地址, 失败返回0
+ */
+static uint64 pcp_alloc(bool in_kernel, uint32 flags, bool *need_zero)
 {
     // 根据参数选择目标内存池
     alloc_region_t *pool = in_kernel ? &kernel_pool : &user_pool;
-    void *ret_addr = NULL;
+    uint64 pa = 0;
 
-    // 获取锁，保证分配过程原子性
-    spinlock_acquire(&pool->lk);
+    // 关中断后本地缓存只会被当前CPU访问
+    push_off();
+    cache_check_drain();
+    page_cache_t *cache = &page_caches[mycpuid()][in_kernel];
 
-    // 从链表头取出一个空闲页
-    page_node_t *node = pool->list_head.next;
-    
-    if (node != NULL) {
-        // 成功获取：更新链表头指向下一个节点
-        pool->list_head.next = node->next;
-        pool->allocable--;
-        ret_addr = (void *)node;
+    // 本地缓存为空时从伙伴系统批量补充
+    if (cache->count + cache->zero_count == 0) {
+        cache->miss++;
+        cache_refill(pool, cache);
+        // 本区域耗尽, 尝试向另一个区域借内存
+        if (cache->count == 0 && pool_borrow(pool, 0))
+            cache_refill(pool, cache);
     } else {
-        // 内存耗尽，释放锁并 panic
-        spinlock_release(&pool->lk);
-        panic(in_kernel ? "pmem_alloc: kernel memory exhausted" : "pmem_alloc: user memory exhausted");
+        cache->hit++;
     }
 
-    spinlock_release(&pool->lk);
+    if (flags & PMEM_ZERO) {
+        // 优先使用预清零页面, 否则拿脏页自己清零
+        pa = cache_pop(&cache->zero_head, &cache->zero_count);
+        if (pa != 0) {
+            cache->zero_hit++;
+        } else {
+            pa = cache_pop(&cache->list_head, &cache->count);
+            *need_zero = true;
+        }
+    } else {
+        // 优先使用脏页, 把预清零页面留给需要的人
+        pa = cache_pop(&cache->list_head, &cache->count);
+        if (pa == 0)
+            pa = cache_pop(&cache->zero_head, &cache->zero_count);
+    }
+
+    pop_off();
+
+    return pa;
+}
 
-    // 分配出的物理页可能包含旧数据，必须清零
-    if (ret_addr) {
-        memset(ret_addr, 0, PGSIZE);
+/*
+ * 分配一个物理页
+ * in_kernel: true 表示从内核池分配，false 表示从用户池分配
+ * flags: PMEM_ZERO 表示调用者需要全0的页面, 否则页面内容未定义
+ * 返回值: 分配到的物理页的首地址；回收之后仍然耗尽则返回NULL
+ */
+void *pmem_alloc_flags(bool in_kernel, uint32 flags)
+{
+    bool need_zero = false;
+    uint64 pa = pcp_alloc(in_kernel, flags, &need_zero);
+
+    // 本地缓存和伙伴系统都已耗尽: 先让回收链和其他CPU释放缓存, 再重试一次
+    if (pa == 0) {
+        pmem_reclaim(PCP_BATCH);
+        need_zero = false;
+        pa = pcp_alloc(in_kernel, flags, &need_zero);
     }
 
-    return ret_addr;
+    if (pa == 0) {
+        pmem_alloc_fail();
+        return NULL;
+    }
+    pa_to_page(pa)->ref = 1;
+
+    // 清零放在关中断区域之外, 不影响中断延迟
+    if (need_zero)
+        memset((void *)pa, 0, PGSIZE);
+
+    return (void *)pa;
+}
+
+/*
+ * 分配一个物理页
+ * in_kernel: true 表示从内核池分配，false 表示从用户池分配
+ * 返回值: 分配到的物理页的首地址（已清零）；耗尽则返回NULL
+ */
+void *pmem_alloc(bool in_kernel)
+{
+    return pmem_alloc_flags(in_kernel, PMEM_ZERO);
+}
+
+/*
+ * 注册一个内存紧张时的回收函数 (只能在初始化阶段调用)
+ * 分配失败时按注册顺序调用
+ */
+void pmem_register_reclaim(reclaim_fn_t fn)
+{
+    if (nr_reclaim >= N_RECLAIM)
+        panic("pmem_register_reclaim: too many reclaimers");
+    reclaim_chain[nr_reclaim++] = fn;
 }
 
 /*
@@ -118,17 +502,240 @@ void pmem_free(uint64 page, bool in_kernel)
         panic("pmem_free: address not page aligned");
     }
     
-    if (page < pool->begin || page >= pool->end) {
+    if (page < (uint64)ALLOC_BEGIN || page >= (uint64)ALLOC_END) {
         panic("pmem_free: address out of range");
     }
 
+    if (chunk_owner[PA_TO_CHUNK(page)] != pool->id) {
+        panic("pmem_free: page not owned by this pool");
+    }
+
+    // 共享的页面只减少引用计数, 最后一个使用者才真正释放
+    uint32 old_ref = __sync_fetch_and_sub(&pa_to_page(page)->ref, 1);
+    if (old_ref == 0)
+        panic("pmem_free: page not allocated");
+    if (old_ref > 1)
+        return;
+
+    push_off();
+    cache_check_drain();
+    page_cache_t *cache = &page_caches[mycpuid()][in_kernel];
+
+    // 释放的页面内容未知，插入到本地脏页链表
+    cache_push(&cache->list_head, &cache->count, page);
+
+    // 本地缓存过满时批量归还给伙伴系统
+    if (cache->count + cache->zero_count >= PCP_HIGH)
+        cache_drain(pool, cache);
+
+    pop_off();
+}
+
+/*
+ * 增加一个已分配页面的引用计数 (写时复制时让另一个页表共享该页面)
+ * 每次pmem_get都需要一次对应的pmem_free
+ */
+void pmem_get(uint64 page)
+{
+    if (page < (uint64)ALLOC_BEGIN || page >= (uint64)ALLOC_END)
+        panic("pmem_get: address out of range");
+    if (__sync_fetch_and_add(&pa_to_page(page)->ref, 1) == 0)
+        panic("pmem_get: page not allocated");
+}
+
+// 查询页面当前的引用计数
+uint32 pmem_refcnt(uint64 page)
+{
+    return *(volatile uint32 *)&pa_to_page(page)->ref;
+}
+
+/*
+ * 调度器空闲时调用: 为当前CPU的本地缓存预先清零一批页面
+ * 每次调用每个内存池最多清零PCP_BATCH个页面, 避免长时间占用调度器
+ */
+void pmem_idle_zero()
+{
+    // 其他CPU内存紧张时不再囤积预清零页面
+    push_off();
+    bool drained = drain_req[mycpuid()];
+    cache_check_drain();
+    pop_off();
+    if (drained)
+        return;
+
+    for (int j = 0; j < 2; j++) {
+        alloc_region_t *pool = j ? &kernel_pool : &user_pool;
+
+        for (int i = 0; i < PCP_BATCH; i++) {
+            push_off();
+            page_cache_t *cache = &page_caches[mycpuid()][j];
+            uint64 pa = 0;
+            if (cache->zero_count < PCP_ZERO_HIGH) {
+                if (cache->count == 0)
+                    cache_refill(pool, cache);
+                pa = cache_pop(&cache->list_head, &cache->count);
+            }
+            pop_off();
+
+            if (pa == 0)
+                break;
+
+            // 此时页面不在任何链表上, 可以开着中断慢慢清零
+            memset((void *)pa, 0, PGSIZE);
+
+            push_off();
+            cache = &page_caches[mycpuid()][j];
+            cache_push(&cache->zero_head, &cache->zero_count, pa);
+            cache->zeroed++;
+            pop_off();
+        }
+    }
+}
+
+/*
+ * 分配2^order个物理地址连续的页面
+ * order为0时等价于pmem_alloc
+ * 返回值: 首页地址（已清零, 按 2^order 页对齐）；回收之后仍然耗尽则返回NULL
+ */
+void *pmem_alloc_order(uint32 order, bool in_kernel)
+{
+    if (order == 0)
+        return pmem_alloc(in_kernel);
+    if (order >= MAX_ORDER)
+        panic("pmem_alloc_order: order too large");
+
+    alloc_region_t *pool = in_kernel ? &kernel_pool : &user_pool;
+
     spinlock_acquire(&pool->lk);
+    uint64 pa = buddy_alloc(pool, order);
+    spinlock_release(&pool->lk);
+
+    // 本区域没有足够大的块, 尝试向另一个区域借内存
+    if (pa == 0 && pool_borrow(pool, order)) {
+        spinlock_acquire(&pool->lk);
+        pa = buddy_alloc(pool, order);
+        spinlock_release(&pool->lk);
+    }
+
+    // 仍然失败: 运行回收链后重试一次 (回收的是零散页面, 不一定能凑出大块)
+    if (pa == 0) {
+        pmem_reclaim(1u << order);
+        spinlock_acquire(&pool->lk);
+        pa = buddy_alloc(pool, order);
+        spinlock_release(&pool->lk);
+        if (pa == 0 && pool_borrow(pool, order)) {
+            spinlock_acquire(&pool->lk);
+            pa = buddy_alloc(pool, order);
+            spinlock_release(&pool->lk);
+        }
+    }
+
+    if (pa == 0) {
+        pmem_alloc_fail();
+        return NULL;
+    }
+    pa_to_page(pa)->ref = 1;
+
+    memset((void *)pa, 0, (uint32)PGSIZE << order);
+
+    return (void *)pa;
+}
+
+/*
+ * 释放pmem_alloc_order申请的2^order个连续页面
+ */
+void pmem_free_order(uint64 page, uint32 order, bool in_kernel)
+{
+    if (order == 0) {
+        pmem_free(page, in_kernel);
+        return;
+    }
+
+    alloc_region_t *pool = in_kernel ? &kernel_pool : &user_pool;
+
+    if (order >= MAX_ORDER)
+        panic("pmem_free_order: order too large");
+    if (page % ((uint64)PGSIZE << order) != 0)
+        panic("pmem_free_order: address not aligned");
+    if (page < (uint64)ALLOC_BEGIN || page + ((uint64)PGSIZE << order) > (uint64)ALLOC_END)
+        panic("pmem_free_order: address out of range");
+    if (chunk_owner[PA_TO_CHUNK(page)] != pool->id)
+        panic("pmem_free_order: page not owned by this pool");
 
-    // 将物理页转换回节点结构，插入到链表头部
-    page_node_t *node = (page_node_t *)page;
-    node->next = pool->list_head.next;
-    pool->list_head.next = node;
-    pool->allocable++;
+    // 共享的块 (fork 之后的写时复制大页) 只减少引用计数, 最后一个使用者才真正释放
+    uint32 old_ref = __sync_fetch_and_sub(&pa_to_page(page)->ref, 1);
+    if (old_ref == 0)
+        panic("pmem_free_order: block not allocated");
+    if (old_ref > 1)
+        return;
 
+    spinlock_acquire(&pool->lk);
+    buddy_free(pool, page, order);
+    spinlock_release(&pool->lk);
+}
+
+/*
+ * 把pmem_alloc_order申请的2^order个连续页面拆成独立的单页
+ * 之后每个页面都可以单独用pmem_free释放 (例如用户大页被部分解除映射)
+ */
+void pmem_split_order(uint64 page, uint32 order)
+{
+    if (page % ((uint64)PGSIZE << order) != 0)
+        panic("pmem_split_order: address not aligned");
+    if (pa_to_page(page)->ref != 1)
+        panic("pmem_split_order: block is shared or not allocated");
+
+    for (uint32 i = 1; i < (1u << order); i++)
+        pa_to_page(page + (uint64)i * PGSIZE)->ref = 1;
+}
+
+/*
+ * 查询某个内存池中第order阶空闲块的数量 (碎片化程度)
+ * 注意: 不包含各CPU本地缓存里的单页
+ */
+uint32 pmem_free_blocks(uint32 order, bool in_kernel)
+{
+    alloc_region_t *pool = in_kernel ? &kernel_pool : &user_pool;
+    uint32 ret;
+
+    if (order >= MAX_ORDER)
+        return 0;
+
+    spinlock_acquire(&pool->lk);
+    ret = pool->nr_free[order];
     spinlock_release(&pool->lk);
-}
\ No newline at end of file
+
+    return ret;
+}
+
+/*
+ * 输出物理内存池和各CPU本地缓存的状态 (用于调整PCP_BATCH/PCP_HIGH)
+ */
+void pmem_stat()
+{
+    printf("pmem: kernel pool free = %d, user pool free = %d\n",
+        kernel_pool.allocable, user_pool.allocable);
+    printf("pmem: kernel pool borrowed %d chunks and lent %d chunks (%d pages per chunk)\n",
+        kernel_pool.borrowed, kernel_pool.lent, CHUNK_PAGES);
+    printf("pmem: never allocated pages: kernel = %d, user = %d\n",
+        (int)((kernel_pool.end - kernel_pool.frontier) / PGSIZE),
+        (int)((user_pool.end - user_pool.frontier) / PGSIZE));
+    printf("pmem: reclaim runs = %d, reclaimed pages = %d, failed allocations = %d\n",
+        reclaim_runs, reclaim_pages, alloc_failed);
+
+    for (int j = 1; j >= 0; j--) {
+        printf("%s pool free blocks per order:", j ? "kernel" : "user");
+        for (int order = 0; order < MAX_ORDER; order++)
+            printf(" %d", pmem_free_blocks(order, j));
+        printf("\n");
+    }
+
+    for (int i = 0; i < NCPU; i++) {
+        for (int j = 1; j >= 0; j--) {
+            page_cache_t *cache = &page_caches[i][j];
+            printf("cpu %d %s cache: dirty = %d, zeroed = %d, hit = %d, miss = %d, refill = %d, drain = %d, zero_hit = %d, idle_zeroed = %d\n",
+                i, j ? "kernel" : "user", cache->count, cache->zero_count, cache->hit, cache->miss,
+                cache->refill, cache->drain, cache->zero_hit, cache->zeroed);
+        }
+    }
+}
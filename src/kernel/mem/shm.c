@@ -0,0 +1,117 @@
+#include "mod.h"
+
+// 共享内存对象表, 对象编号即下标
+static shm_t shm_table[N_SHM];
+static spinlock_t shm_lk; // 保护 shm_table
+
+void shm_init()
+{
+    spinlock_init(&shm_lk, "shm");
+    for (int i = 0; i < N_SHM; i++) {
+        shm_table[i].used = false;
+        shm_table[i].npages = 0;
+        shm_table[i].pages = NULL;
+    }
+}
+
+// 释放对象持有的页面引用和页面地址表
+static void shm_release(shm_t *shm, uint32 npages)
+{
+    for (uint32 i = 0; i < npages; i++)
+        pmem_free(shm->pages[i], false);
+    pmem_free((uint64)shm->pages, true);
+    shm->pages = NULL;
+    shm->npages = 0;
+}
+
+/*
+ * 创建一个包含 npages 个全0页面的共享内存对象
+ * 返回值: 成功返回对象编号, 参数非法、对象表已满或者内存不足返回-1
+ */
+int shm_create(uint32 npages)
+{
+    if (npages == 0 || npages > SHM_MAX_PAGES)
+        return -1;
+
+    // 先占用一个表项, 分配页面时不需要持有锁
+    spinlock_acquire(&shm_lk);
+    int id = -1;
+    for (int i = 0; i < N_SHM; i++) {
+        if (!shm_table[i].used && shm_table[i].pages == NULL) {
+            id = i;
+            break;
+        }
+    }
+    if (id < 0) {
+        spinlock_release(&shm_lk);
+        return -1;
+    }
+    shm_t *shm = &shm_table[id];
+    shm->pages = (uint64 *)pmem_alloc(true);
+    if (shm->pages == NULL) {
+        spinlock_release(&shm_lk);
+        return -1;
+    }
+    spinlock_release(&shm_lk);
+
+    for (uint32 i = 0; i < npages; i++) {
+        void *page = pmem_alloc(false); // 已清零, 引用计数为1 (属于对象)
+        if (page == NULL) {
+            spinlock_acquire(&shm_lk);
+            shm_release(shm, i);
+            spinlock_release(&shm_lk);
+            return -1;
+        }
+        shm->pages[i] = (uint64)page;
+    }
+
+    spinlock_acquire(&shm_lk);
+    shm->npages = npages;
+    shm->used = true;
+    spinlock_release(&shm_lk);
+    return id;
+}
+
+/*
+ * 把共享内存对象映射到当前进程
+ * start: 建议起始地址 (0表示自动分配)
+ * 返回值: 成功返回映射的起始地址, 对象不存在、地址范围不可用或者内存不足返回-1
+ */
+uint64 shm_map(int id, uint64 start)
+{
+    if (id < 0 || id >= N_SHM)
+        return (uint64)-1;
+
+    // 持有锁直到每个页面都增加了映射的引用, 防止并发的 shm_destroy 释放页面
+    spinlock_acquire(&shm_lk);
+    shm_t *shm = &shm_table[id];
+    if (!shm->used) {
+        spinlock_release(&shm_lk);
+        return (uint64)-1;
+    }
+    uint64 addr = uvm_mmap_shared(start, shm->npages, shm->pages);
+    spinlock_release(&shm_lk);
+    return addr;
+}
+
+/*
+ * 销毁共享内存对象: 归还对象持有的页面引用, 对象编号可以被再次使用
+ * 已经建立的映射不受影响, 直到它们被解除时页面才真正释放
+ * 返回值: 成功返回0, 对象不存在返回-1
+ */
+int shm_destroy(int id)
+{
+    if (id < 0 || id >= N_SHM)
+        return -1;
+
+    spinlock_acquire(&shm_lk);
+    shm_t *shm = &shm_table[id];
+    if (!shm->used) {
+        spinlock_release(&shm_lk);
+        return -1;
+    }
+    shm->used = false;
+    shm_release(shm, shm->npages);
+    spinlock_release(&shm_lk);
+    return 0;
+}
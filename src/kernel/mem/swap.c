@@ -0,0 +1,336 @@
+#include "mod.h"
+#include "../fs/mod.h"
+
+// 交换槽位: 占用的磁盘块 (0表示还没有申请磁盘块) 和引用该槽位的换出项数量
+static uint32 swap_block[SWAP_MAX_SLOTS];
+static uint16 swap_ref[SWAP_MAX_SLOTS];
+
+static bool swap_on;      // 文件系统初始化之后才能使用磁盘
+static bool swapping;     // 同一时间只有一个换出过程 (换出途中的磁盘操作也可能申请内存)
+static int inflight = -1; // 正在写入磁盘的槽位, 换入它的进程需要等待写入完成
+static spinlock_t swap_lk; // 保护以上字段和统计信息
+
+// 时钟指针: 进程池下标 + 进程内的虚拟地址 (只由持有 swapping 的换出过程使用)
+static int clock_proc;
+static uint64 clock_va;
+
+// 统计信息
+static uint32 nr_slots;
+static uint32 nr_idle_blocks; // 空闲槽位仍然占有的磁盘块数 (等待复用或者归还 data bitmap)
+static uint64 nr_swap_out;
+static uint64 nr_swap_in;
+static uint64 nr_second_chance;
+
+// 只有进程上下文且没有持有自旋锁(没有关中断)时才能睡眠等待磁盘
+static bool swap_can_sleep()
+{
+    push_off();
+    bool ok = (myproc() != NULL && mycpu()->noff == 1);
+    pop_off();
+    return ok;
+}
+
+// 以页面为单位读写交换区的一个磁盘块
+static void swap_rw(uint32 block, uint64 pa, bool write)
+{
+    buffer_t b;
+    memset(&b, 0, sizeof(b));
+    b.block_num = block;
+    b.data = (uint8 *)pa;
+    virtio_disk_rw(&b, write);
+}
+
+// 申请一个空闲槽位, 优先复用已经占有磁盘块的槽位 (可能睡眠), 失败返回-1
+static int swap_slot_alloc()
+{
+    int empty = -1;
+
+    spinlock_acquire(&swap_lk);
+    for (int i = 0; i < SWAP_MAX_SLOTS; i++) {
+        if (swap_ref[i] != 0)
+            continue;
+        if (swap_block[i] != 0) {
+            swap_ref[i] = 1;
+            nr_slots++;
+            nr_idle_blocks--;
+            spinlock_release(&swap_lk);
+            return i;
+        }
+        if (empty < 0)
+            empty = i;
+    }
+    if (empty < 0) {
+        spinlock_release(&swap_lk);
+        return -1;
+    }
+    // 先占住槽位再释放锁申请磁盘块
+    swap_ref[empty] = 1;
+    nr_slots++;
+    spinlock_release(&swap_lk);
+
+    uint32 block = bitmap_alloc_block();
+
+    // 这个块之前可能被文件系统使用过, 交换区绕过 buf_cache 读写磁盘, 先丢弃缓存中的旧副本
+    if (block != (uint32)-1)
+        buffer_invalidate(block);
+
+    spinlock_acquire(&swap_lk);
+    if (block == (uint32)-1) {
+        swap_ref[empty] = 0;
+        nr_slots--;
+        empty = -1;
+    } else {
+        swap_block[empty] = block;
+    }
+    spinlock_release(&swap_lk);
+    return empty;
+}
+
+// 增加槽位的引用 (fork复制换出项)
+void swap_dup(uint32 slot)
+{
+    spinlock_acquire(&swap_lk);
+    if (slot >= SWAP_MAX_SLOTS || swap_ref[slot] == 0)
+        panic("swap_dup");
+    swap_ref[slot]++;
+    spinlock_release(&swap_lk);
+}
+
+// 把空闲槽位仍然占有的磁盘块全部还给 data bitmap (会睡眠)
+static void swap_release_blocks()
+{
+    for (;;) {
+        uint32 block = 0;
+        spinlock_acquire(&swap_lk);
+        for (int i = 0; nr_idle_blocks > 0 && i < SWAP_MAX_SLOTS; i++) {
+            if (swap_ref[i] == 0 && swap_block[i] != 0) {
+                block = swap_block[i];
+                swap_block[i] = 0;
+                nr_idle_blocks--;
+                break;
+            }
+        }
+        spinlock_release(&swap_lk);
+
+        if (block == 0)
+            return;
+        bitmap_free_block(block);
+    }
+}
+
+/*
+ * 换出项被丢弃时归还槽位的引用 (进程退出、解除映射、写时复制)
+ * 最后一个引用被归还时, 可以睡眠则立即把磁盘块还给 data bitmap;
+ * 否则 (例如持有进程锁释放进程) 磁盘块暂时留在空闲槽位上, 由之后的换出复用,
+ * 或者在下一次可以睡眠的 swap_put / swap_in 中归还
+ */
+void swap_put(uint32 slot)
+{
+    bool idle = false;
+
+    spinlock_acquire(&swap_lk);
+    if (slot >= SWAP_MAX_SLOTS || swap_ref[slot] == 0)
+        panic("swap_put");
+    if (--swap_ref[slot] == 0) {
+        nr_slots--;
+        if (swap_block[slot] != 0) {
+            nr_idle_blocks++;
+            idle = true;
+        }
+    }
+    spinlock_release(&swap_lk);
+
+    if (idle && swap_can_sleep())
+        swap_release_blocks();
+}
+
+/*
+ * 时钟算法: 从上次停下的位置继续检查各进程的私有用户页面, 挑选一个最近没有被访问的页面
+ * 找到后把它的PTE改为指向 slot 的换出项, 返回页面的物理地址 (调用者负责写盘后释放)
+ * 检查了 SWAP_SCAN_MAX 个页面或者转完一圈仍然没有找到时返回0
+ */
+static uint64 clock_evict(uint32 slot)
+{
+    proc_t *curr = myproc();
+    uint32 scanned = 0;
+    int visited = 0;
+
+    while (scanned < SWAP_SCAN_MAX && visited <= N_PROC) {
+        proc_t *p = proc_get(clock_proc);
+        uint64 victim = 0;
+        bool finished = true;
+
+        spinlock_acquire(&p->lk);
+        // 与 KSM 相同, 其他进程只处理从用户态让出CPU、等待运行的进程 (见 mem/type.h)
+        if (p->pgtbl != NULL &&
+            (p == curr || (p->state == RUNNABLE && !p->kpreempted && p->sleep_space == NULL))) {
+            uint64 va = uvm_next_private_va(p, clock_va);
+            for (; va != 0 && scanned < SWAP_SCAN_MAX; va = uvm_next_private_va(p, va + PGSIZE)) {
+                scanned++;
+                int level;
+                pte_t *pte = vm_getleaf(p->pgtbl, va, &level);
+                if (pte == NULL || level != 0 || (*pte & (PTE_V | PTE_U)) != (PTE_V | PTE_U))
+                    continue;
+                uint64 pa = PTE_TO_PA(*pte);
+                if (pmem_refcnt(pa) != 1)
+                    continue;
+
+                // 最近被访问过: 清除访问位, 给它第二次机会
+                if (*pte & PTE_A) {
+                    *pte &= ~PTE_A;
+                    asid_flush(p, va, PGSIZE);
+                    nr_second_chance++;
+                    continue;
+                }
+
+                // 只剩一个引用的写时复制页面换入后是私有的, 恢复写权限
+                int flags = PTE_FLAGS(*pte) & (PTE_R | PTE_W | PTE_X | PTE_U);
+                if (*pte & PTE_COW)
+                    flags |= PTE_W;
+                *pte = SLOT_TO_PTE(slot, flags);
+                asid_flush(p, va, PGSIZE);
+                victim = pa;
+                va += PGSIZE;
+                break;
+            }
+            clock_va = va;
+            finished = (va == 0);
+        }
+        spinlock_release(&p->lk);
+
+        if (victim != 0)
+            return victim;
+        if (finished) {
+            visited++;
+            clock_va = 0;
+            clock_proc = (clock_proc + 1) % N_PROC;
+        }
+    }
+    return 0;
+}
+
+// 回收函数: 换出最多 target 个页面, 返回换出的页面数
+static uint32 swap_reclaim(uint32 target)
+{
+    if (!swap_can_sleep())
+        return 0;
+
+    spinlock_acquire(&swap_lk);
+    if (!swap_on || swapping) {
+        spinlock_release(&swap_lk);
+        return 0;
+    }
+    swapping = true;
+    spinlock_release(&swap_lk);
+
+    uint32 count = 0;
+    while (count < target) {
+        int slot = swap_slot_alloc();
+        if (slot < 0)
+            break;
+
+        // 换出项出现之前标记写入中, 其他CPU上的换入会等待写入完成
+        spinlock_acquire(&swap_lk);
+        inflight = slot;
+        spinlock_release(&swap_lk);
+
+        uint64 pa = clock_evict(slot);
+        if (pa == 0) {
+            spinlock_acquire(&swap_lk);
+            inflight = -1;
+            swap_ref[slot] = 0;
+            nr_slots--;
+            if (swap_block[slot] != 0)
+                nr_idle_blocks++;
+            spinlock_release(&swap_lk);
+            break;
+        }
+
+        swap_rw(swap_block[slot], pa, true);
+
+        spinlock_acquire(&swap_lk);
+        inflight = -1;
+        nr_swap_out++;
+        spinlock_release(&swap_lk);
+        proc_wakeup(&inflight);
+
+        pmem_free(pa, false);
+        count++;
+    }
+
+    spinlock_acquire(&swap_lk);
+    swapping = false;
+    spinlock_release(&swap_lk);
+    return count;
+}
+
+// 文件系统初始化之后调用, 把换出加入回收链
+void swap_init()
+{
+    spinlock_init(&swap_lk, "swap");
+    swap_on = true;
+    pmem_register_reclaim(swap_reclaim);
+}
+
+/*
+ * 缺页时把进程 p 在 va 处的换出页面读回内存 (会睡眠)
+ * 成功返回0, 不能睡眠或者内存不足时返回-1
+ */
+int swap_in(proc_t *p, uint64 va)
+{
+    if (!swap_can_sleep())
+        return -1;
+
+    // 页面会被磁盘数据完整覆盖, 不需要清零
+    void *mem = pmem_alloc_flags(false, 0);
+    if (mem == NULL)
+        return -1;
+
+    // 申请内存时可能触发换出, 之后再读取PTE (换出项只会被进程自己修改)
+    pte_t *pte = vm_getpte(p->pgtbl, va, false);
+    if (pte == NULL || (*pte & PTE_V) || !(*pte & PTE_SWAP)) {
+        pmem_free((uint64)mem, false);
+        return -1;
+    }
+    uint64 old = *pte;
+    uint32 slot = PTE_TO_SLOT(old);
+
+    spinlock_acquire(&swap_lk);
+    while (inflight == (int)slot)
+        proc_sleep(&inflight, &swap_lk);
+    uint32 block = swap_block[slot];
+    spinlock_release(&swap_lk);
+
+    swap_rw(block, (uint64)mem, false);
+
+    // 刚换入的页面带上访问位, 避免马上又被换出
+    *pte = PA_TO_PTE((uint64)mem) | PTE_FLAGS(old & (PTE_R | PTE_W | PTE_X | PTE_U)) | PTE_V | PTE_A;
+    vm_flush(p->pgtbl, va, PGSIZE);
+
+    // 最后一个引用: 磁盘块还给 data bitmap
+    uint32 release = 0;
+    spinlock_acquire(&swap_lk);
+    nr_swap_in++;
+    if (--swap_ref[slot] == 0) {
+        nr_slots--;
+        release = swap_block[slot];
+        swap_block[slot] = 0;
+    }
+    spinlock_release(&swap_lk);
+
+    if (release != 0)
+        bitmap_free_block(release);
+    swap_release_blocks();
+    return 0;
+}
+
+// 输出交换统计信息
+void swap_stat()
+{
+    spinlock_acquire(&swap_lk);
+    printf("\n=== Swap Stat ===\n");
+    printf("slots in use: %d / %d, swapped out: %d, swapped in: %d, second chances: %d\n",
+           nr_slots, SWAP_MAX_SLOTS, (int)nr_swap_out, (int)nr_swap_in, (int)nr_second_chance);
+    printf("disk blocks held by free slots: %d\n", nr_idle_blocks);
+    spinlock_release(&swap_lk);
+}
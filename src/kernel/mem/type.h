@@ -4,38 +4,142 @@
 /*---------------------------------- 关于物理内存 ---------------------------------------*/
 
 /*
-    物理内存管理的核心是空闲页面组成的单链表:
-    kern_reagion和user_region的list_head字段是链表的头节点
-    物理页的分配就是将list_head->next移出链表
-    物理页的回收就是将node插入list_head->next
-    你可能注意到了:我们没有一个和物理页数量一样多的page_node数组
-    那是因为:当page位于空闲页链表时, 它最前面的64bit会被特别设置为next指针, 当它被分配出去后则作为普通的空间
+    物理内存管理采用伙伴系统(buddy system):
+    - 每个可分配区域按阶(order)维护MAX_ORDER条空闲链表, 第k条链表上挂着大小为2^k个页面的空闲块
+    - 空闲块的起始物理页号必须是2^k的整数倍, 因此每个块都有唯一的"伙伴": 页号异或2^k得到的块
+    - 分配2^k个页面时, 从不小于k的最小非空链表取块, 多余部分逐级对半拆分挂回低阶链表
+    - 释放时如果伙伴也是同阶空闲块, 就合并成高一阶的块, 直到无法继续合并
+    空闲块的前16字节被用作双向链表节点(page_node), 块被分配出去后作为普通的空间
+    每个物理页还有一个page_t描述符(放在pages数组里), 记录它是否是某个空闲块的首页以及块的阶数
+
+    启动时不再把整个区域切块挂入空闲链表, 而是为每个区域维护一个"从未分配"的前沿(frontier):
+    - [frontier, end) 从未被分配过, 启动时不触碰其中任何一个页面
+    - 空闲链表中没有足够大的块时, 才从前沿按对齐切出一个块, 对齐产生的空隙挂入空闲链表
+    - 前沿切不出需要的块时, 把剩余部分一次性交给空闲链表
+    因此启动时间不再随物理内存大小增长
 */
 
 // 物理页是最基本的资源单位, 大小设置为4KB
 #define PGSIZE 4096
 
-// 物理页节点
+// 伙伴系统的阶数上限: 最大的连续块包含2^(MAX_ORDER-1)个页面 (4MB)
+#define MAX_ORDER 11
+
+// 空闲块节点 (双向循环链表)
 typedef struct page_node
 {
     struct page_node *next;
+    struct page_node *prev;
 } page_node_t;
 
 // 许多物理页构成一个可分配的区域
 typedef struct alloc_region
 {
-    uint64 begin;          // 起始物理地址
-    uint64 end;            // 终止物理地址
-    spinlock_t lk;         // 自旋锁(保护下面两个变量)
-    uint32 allocable;      // 可分配页面数
-    page_node_t list_head; // 可分配链的链头节点
+    uint64 begin;                        // 初始的起始物理地址
+    uint64 end;                          // 初始的终止物理地址
+    uint8 id;                            // 区域编号 (POOL_KERNEL/POOL_USER)
+    spinlock_t lk;                       // 自旋锁(保护下面六个变量)
+    uint32 allocable;                    // 可分配页面数 (包括前沿之后的页面)
+    uint64 frontier;                     // 从未分配过的区域的起始地址, [frontier, end)未被触碰
+    page_node_t free_area[MAX_ORDER];    // 各阶空闲链表的头节点
+    uint32 nr_free[MAX_ORDER];           // 各阶空闲块的数量
+    uint32 borrowed;                     // 从另一个区域借入的chunk数量
+    uint32 lent;                         // 借给另一个区域的chunk数量
 } alloc_region_t;
 
+/*
+    内核区域和用户区域之间的动态平衡:
+    物理内存被划分成CHUNK_PAGES个页面一组的chunk, chunk_owner记录每个chunk当前属于哪个区域
+    当某个区域的伙伴系统耗尽时, 从另一个区域申请一个完整空闲的chunk(或更大的块),
+    修改这些chunk的归属后挂入自己的伙伴系统, 之后这些页面在本区域内正常分配、释放与合并
+    不变式: 伙伴系统中的每个空闲块都完整地位于其所在区域拥有的chunk之内
+*/
+
+#define CHUNK_ORDER 6                  // 区域之间迁移内存的最小单位: 2^6个页面 (256KB)
+#define CHUNK_PAGES (1 << CHUNK_ORDER)
+#define CHUNK_SIZE (CHUNK_PAGES * PGSIZE)
+
+#define POOL_NONE 0   // 不可分配的内存 (内核镜像)
+#define POOL_KERNEL 1 // 属于内核区域
+#define POOL_USER 2   // 属于用户区域
+
+// 物理页描述符
+// 全0是描述符的默认状态 (pages数组位于bss段), 前沿之后的页面不需要初始化描述符
+typedef struct page
+{
+    uint8 flags; // 页面状态
+    uint8 order; // 空闲块的阶数 (仅在PG_BUDDY置位时有效)
+    uint32 ref;  // 引用计数 (仅对已分配的页面有效, 写时复制的页面会被多个页表共享)
+} page_t;
+
+#define PG_BUDDY (1 << 0) // 该页是伙伴系统中某个空闲块的首页
+
+// 物理内存总量 (与kernel.ld中的ALLOC_END保持一致)
+#define PHYS_SIZE (128ul * 1024 * 1024)
+
+// 物理页描述符的数量以及物理地址到描述符下标的转换
+#define N_PHYS_PAGES (PHYS_SIZE / PGSIZE)
+#define PA_TO_PFN(pa) (((uint64)(pa) - KERNEL_BASE) / PGSIZE)
+
+// chunk的数量以及物理地址到chunk下标的转换
+#define N_CHUNKS (N_PHYS_PAGES / CHUNK_PAGES)
+#define PA_TO_CHUNK(pa) (PA_TO_PFN(pa) / CHUNK_PAGES)
+
+/*
+    每个CPU在伙伴系统前面维护一个单页的本地页面缓存(page_cache):
+    - 分配单页时优先从本地缓存取页, 本地为空时一次性从伙伴系统搬运PCP_BATCH个页面
+    - 释放单页时优先放回本地缓存, 本地页面数达到PCP_HIGH时一次性归还PCP_BATCH个页面
+    本地缓存只被所在CPU访问, 关中断即可保证互斥, 不需要获取alloc_region的自旋锁
+    分配失败触发回收时, 通过drain_req请求其他CPU在下一次操作本地缓存时把缓存全部归还伙伴系统
+
+    本地缓存分成两条链表: 脏页链表(内容未知)和预清零链表(内容全0)
+    - 调度器空闲时调用pmem_idle_zero, 把脏页清零后移入预清零链表, 直到达到PCP_ZERO_HIGH
+    - 需要清零的分配优先取预清零页面, 否则取脏页并当场清零
+    - 不需要清零的分配(马上会被完整覆盖的页面)优先取脏页, 把预清零页面留给需要的人
+*/
+
+#define PCP_BATCH 16     // 本地缓存与伙伴系统之间批量搬运的页面数
+#define PCP_HIGH 64      // 本地缓存持有页面数的上限
+#define PCP_ZERO_HIGH 32 // 空闲时最多预先清零的页面数
+
+// pmem_alloc_flags的分配标志
+#define PMEM_ZERO (1 << 0) // 调用者需要全0的页面
+
+// CPU本地的页面缓存
+typedef struct page_cache
+{
+    page_node_t list_head; // 本地脏页链表的头节点 (单向, 只使用next)
+    uint32 count;          // 本地脏页数量
+    page_node_t zero_head; // 本地预清零链表的头节点 (单向, 只使用next)
+    uint32 zero_count;     // 本地预清零页面数量
+    uint32 hit;            // 分配时本地缓存命中次数
+    uint32 miss;           // 分配时本地缓存为空的次数
+    uint32 refill;         // 从伙伴系统批量补充的次数
+    uint32 drain;          // 向伙伴系统批量归还的次数
+    uint32 zero_hit;       // 需要清零的分配直接拿到预清零页面的次数
+    uint32 zeroed;         // 空闲时清零的页面数
+} page_cache_t;
+
+/*
+    内存紧张时的回收链:
+    - 子系统在初始化时通过pmem_register_reclaim注册回收函数 (例如buffer缓存)
+    - 分配失败时(本区域和借用都失败), pmem按注册顺序调用回收函数, 直到回收够目标页数
+    - 回收完成后重试一次, 仍然失败才返回NULL, 由调用者自行处理
+    回收函数可能在调用者持有任意锁、关闭中断的情况下被调用:
+    不允许获取调用者已经持有的锁 (用spinlock_holding检查后直接放弃),
+    需要睡眠的回收函数(交换)自行检查当前上下文, 不能睡眠时直接放弃
+*/
+
+#define N_RECLAIM 4 // 最多注册的回收函数数量
+
+// 回收函数: 尝试释放target个页面, 返回实际释放的页面数
+typedef uint32 (*reclaim_fn_t)(uint32 target);
+
 /*
     物理内存的布局情况:
     KERNEL_BASE ~ KERNEL_DATA  内核程序kernel-qemu.elf的代码区域 (不可分配回收)
     KERNEL_DATA ~ ALLOC_BEGIN  内核程序kernel-qemu.elf的数据区域 (不可分配回收)
-    ALLOC_BEGIN ~ ALLOC_END    可分配回收的区域 (前KERN_PAGES属于内核空间, 后面属于用户空间)
+    ALLOC_BEGIN ~ ALLOC_END    可分配回收的区域 (初始时前KERN_PAGES(向上对齐到chunk)属于内核空间, 后面属于用户空间)
 */
 
 // 内核基地址
@@ -46,9 +150,66 @@ extern char KERNEL_DATA[];
 extern char ALLOC_BEGIN[];
 extern char ALLOC_END[];
 
-// 可分配回收的区域中内核持有前KERN_PAGES个页面
+// 可分配回收的区域中内核初始持有前KERN_PAGES个页面 (运行时可与用户区域互相借用)
 #define KERN_PAGES 1024
 
+/*---------------------------------- 关于内核对象 ---------------------------------------*/
+
+/*
+    kmalloc是建立在pmem_alloc(true)之上的slab分配器, 用于分配比一个页面小得多的内核对象
+    - 对象按尺寸分为KMALLOC_NCLASS级(32B ~ 1024B), 每一级由一个kmem_cache管理
+    - kmem_cache向内核池申请整页作为slab, 页面开头是slab_t描述符, 后面切成等长的对象
+    - 空闲对象的前8字节被用作next指针, 串成slab内部的空闲链表
+    - 每个kmem_cache为每个CPU维护一个本地空闲对象链表, 分配/释放的常见路径只需关中断
+    - 释放时按页对齐找到对象所在的slab_t, 进而找到所属的kmem_cache
+*/
+
+#define KMALLOC_MIN_SHIFT 5                                          // 最小对象 32B
+#define KMALLOC_NCLASS 6                                             // 尺寸分级数量
+#define KMALLOC_MAX (1 << (KMALLOC_MIN_SHIFT + KMALLOC_NCLASS - 1)) // 最大对象 1024B
+
+#define KMEM_CPU_BATCH 8 // 本地链表与slab之间批量搬运的对象数
+#define KMEM_CPU_HIGH 16 // 本地链表持有对象数的上限
+
+#define SLAB_MAGIC 0x51ab51ab // 用于检查kfree的参数是否来自kmalloc
+
+// 空闲对象节点
+typedef struct kmem_obj
+{
+    struct kmem_obj *next;
+} kmem_obj_t;
+
+// slab描述符 (位于slab页面的开头)
+typedef struct slab
+{
+    uint32 magic;              // SLAB_MAGIC
+    uint32 inuse;              // 已分配出去的对象数量
+    struct kmem_cache *cache;  // 所属的kmem_cache
+    kmem_obj_t *free;          // slab内的空闲对象链表
+    struct slab *next;         // partial/full链表
+    struct slab *prev;         // partial/full链表
+} slab_t;
+
+// CPU本地的空闲对象链表
+typedef struct kmem_cpu
+{
+    kmem_obj_t *free; // 空闲对象链表
+    uint32 count;     // 空闲对象数量
+} kmem_cpu_t;
+
+// 同一尺寸对象的仓库
+typedef struct kmem_cache
+{
+    uint32 size;            // 对象尺寸
+    uint32 per_slab;        // 每个slab容纳的对象数量
+    spinlock_t lk;          // 自旋锁(保护下面四个变量)
+    slab_t partial;         // 还有空闲对象的slab链表的头节点
+    slab_t full;            // 对象全部分配出去的slab链表的头节点
+    uint32 nr_slabs;        // slab数量
+    uint32 nr_inuse;        // 离开slab的对象数量 (包括CPU本地链表中的)
+    kmem_cpu_t cpu[NCPU];   // 各CPU的本地空闲对象链表
+} kmem_cache_t;
+
 /*---------------------------------- 关于虚拟内存 ---------------------------------------*/
 
 /*
@@ -94,6 +255,26 @@ typedef pte_t* pgtbl_t;
 // satp寄存器相关
 #define SATP_SV39 (8L << 60)                                           // MODE = SV39
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12)) // 设置MODE和PPN字段
+#define SATP_ASID_SHIFT 44                                               // ASID字段的起始bit
+#define SATP_ASID_MASK 0xFFFFul                                          // ASID字段最多16bit
+#define MAKE_SATP_ASID(pagetable, asid) (MAKE_SATP(pagetable) | ((uint64)(asid) << SATP_ASID_SHIFT))
+
+/*
+    ASID(地址空间标识符)让TLB同时缓存多个地址空间的表项, 切换页表时不需要刷新整个TLB:
+    - 内核页表使用ASID 0, 每个用户进程在第一次返回用户态时分配一个非0的ASID
+    - ASID按"代"(generation)分配: 本代的ASID用完后代号加1, 所有进程的ASID都随之失效
+      每个CPU发现代号变化时刷新一次整个TLB, 之后本代的ASID就不会和旧表项混淆
+    - 修改用户页表后只刷新本CPU上该ASID的相关表项, 并把其他CPU标记为"过期",
+      进程下次在这些CPU上返回用户态前刷新该ASID的全部表项 (进程可能在CPU之间迁移)
+    - 硬件不支持ASID时所有进程都使用ASID 0, trampoline在切换页表时刷新整个TLB
+    proc->asid的高位是代号, 低ASID_GEN_SHIFT位是ASID
+*/
+#define ASID_GEN_SHIFT 16
+#define ASID_OF(tag) ((tag) & ((1ul << ASID_GEN_SHIFT) - 1))
+#define ASID_GEN(tag) ((tag) >> ASID_GEN_SHIFT)
+
+// 修改范围超过这么多页面时直接刷新整个ASID
+#define TLB_FLUSH_PAGES 64
 
 // 获取虚拟地址中的虚拟页(VPN)信息 占9bit
 #define VA_SHIFT(level) (12 + 9 * (level))
@@ -112,10 +293,21 @@ typedef pte_t* pgtbl_t;
 #define PTE_G (1 << 5) // global
 #define PTE_A (1 << 6) // accessed
 #define PTE_D (1 << 7) // dirty
+#define PTE_COW (1 << 8) // 软件保留位: 写时复制 (与其他页表共享的只读页面, 写入时复制)
+#define PTE_SWAP (1 << 9) // 软件保留位: 无效PTE的页面已换出到磁盘 (PPN字段存放交换槽位号)
 
 // 检查一个PTE是否属于pgtbl
 #define PTE_CHECK(pte) (((pte) & (PTE_R | PTE_W | PTE_X)) == 0)
 
+/*
+    Sv39允许叶子PTE出现在中间层: 第1级的叶子映射一个2MB的大页(megapage)
+    大页的虚拟地址和物理地址都必须按2MB对齐
+    只有 vm_mappages_mega 会放置大页: 内核的直接映射, 以及 mmap 区域的透明大页
+    fork 时用户大页整体以写时复制的方式共享, 写入时复制出新的大页 (失败时拆成512个私有页面)
+*/
+#define LEVEL_PGSIZE(level) ((uint64)PGSIZE << (9 * (level))) // 第level级叶子映射的大小
+#define MEGA_PGSIZE LEVEL_PGSIZE(1)                          // 大页大小 (2MB)
+
 // 获取低10bit的flag信息
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
@@ -134,23 +326,95 @@ typedef pte_t* pgtbl_t;
 // 用户空间基地址 (用户页表)
 #define USER_BASE      (PGSIZE)
 
-/* mmap_region 描述了一个 mmap区域 */
+/*
+    mmap_region 描述了一个 mmap区域
+    每个进程的 mmap区域 组织成一棵以 begin 为键的平衡二叉树 (AVL树)
+    每个节点额外记录子树覆盖的地址范围和子树内部相邻区域之间的最大空隙,
+    查找、寻找空闲地址范围、插入和删除都只需要沿树走一条路径, 复杂度为 O(log n)
+*/
 typedef struct mmap_region
 {
-    uint64 begin;             // 起始地址
-    uint32 npages;            // 管理的页面数量
-    struct mmap_region *next; // 链表指针
+    uint64 begin;              // 起始地址
+    uint32 npages;             // 管理的页面数量
+    int perm;                  // 页面权限 (缺页时按此权限建立映射)
+    bool shared;               // 是否为共享内存区域 (见 shm.c)
+    struct mmap_region *left;  // 左子树 (地址更低的区域)
+    struct mmap_region *right; // 右子树 (地址更高的区域)
+    int height;                // 子树高度
+    uint64 tree_begin;         // 子树中最低的起始地址
+    uint64 tree_end;           // 子树中最高的结束地址
+    uint64 max_gap;            // 子树内部相邻区域之间的最大空隙 (字节)
 } mmap_region_t;
 
-/* mmap_region_node 是 mmap_region 在仓库里的包装 */
-typedef struct mmap_region_node
+// mmap区域的结束地址 (开区间)
+#define MMAP_REGION_END(m) ((m)->begin + (uint64)(m)->npages * PGSIZE)
+
+// sys_mmap和sys_brk的标志位
+#define MAP_POPULATE (1 << 0) // 立即分配并映射所有页面 (默认只保留地址范围, 访问时再分配)
+
+/*
+    缺页预取 (fault-around)
+    在堆、mmap区域或用户栈中发生缺页时, 除了缺页的页面之外,
+    把它所在的按窗口大小对齐的一组相邻页面 (限制在同一区域内) 一并映射, 顺序访问时可以省去后续的缺页
+    窗口大小 (页数) 每个进程可以单独设置, 必须是不超过512的2的幂, 1表示关闭预取
+*/
+#define FAULT_AROUND_PAGES 16
+
+/*
+    共享内存对象 (shm)
+    对象创建时一次性分配全部物理页面, 对象本身和每个映射都持有每个页面的一个引用
+    进程通过对象的编号把页面映射到自己的 mmap 区域 (共享区域), 用 munmap 解除映射
+    销毁对象只是归还对象持有的引用, 仍然映射着的进程可以继续使用, 最后一个引用归还时页面才被释放
+*/
+#define N_SHM 16                                  // 共享内存对象的最大数量
+#define SHM_MAX_PAGES (PGSIZE / sizeof(uint64))   // 单个对象的最大页数 (页面地址表占一个物理页)
+
+typedef struct shm
 {
-    mmap_region_t mmap;
-    struct mmap_region_node *next;
-} mmap_region_node_t;
+    bool used;     // 是否已经创建
+    uint32 npages; // 页面数量
+    uint64 *pages; // 物理页地址表
+} shm_t;
+
+/*
+    相同页面合并 (KSM)
+    进程通过系统调用选择加入后, 调度器空闲时分批扫描这些进程的堆、栈和私有 mmap 区域:
+    - 计算每个4KB页面内容的哈希值, 在稳定表中找到内容相同的页面时,
+      把PTE改为指向稳定页面 (只读 + PTE_COW), 原来的页面随引用归还而释放
+    - 哈希值在本轮扫描中第二次出现时, 把当前页面提升为稳定页面 (同样改为只读 + PTE_COW),
+      之后的扫描会把其他内容相同的页面合并过来 (只出现一次的哈希值记录在不稳定表中, 每轮清空)
+    稳定表持有每个稳定页面的一个引用, 保证其内容不再变化; 写入时由写时复制复制出私有页面
+    每轮扫描结束时, 只剩稳定表引用的稳定页面被释放
+    只扫描从用户态让出CPU、等待运行的进程 (RUNNABLE, 不是在内核态被抢占, 也不是刚从睡眠中被唤醒),
+    此时它没有停在任何内核路径中, 不会持有自己的PTE或者页面地址
+*/
+#define KSM_HASH_SIZE 256 // 哈希表的桶数
+#define KSM_SCAN_BATCH 64 // 每次空闲扫描检查的页面数
+
+typedef struct ksm_node
+{
+    uint32 hash;           // 页面内容的哈希值
+    uint64 pa;             // 稳定页面的物理地址 (不稳定表中为0)
+    struct ksm_node *next; // 同一个桶中的下一个节点
+} ksm_node_t;
+
+/*
+    交换 (swap): 内存不足时把匿名用户页面写到磁盘, 访问时缺页换入
+    - 交换槽位从文件系统的 data bitmap 中按需申请磁盘块 (同时丢弃 buf_cache 中该块的旧副本),
+      最后一个引用释放时把磁盘块还给 data bitmap; 不能睡眠时磁盘块暂留在空闲槽位上, 之后复用或归还
+    - 换出项是 V=0 的叶子PTE: PPN字段存放槽位号, 低位保留 PTE_SWAP 和原来的 R/W/X/U 权限
+      fork 时子进程复制换出项并增加槽位的引用, 双方各自换入得到私有页面
+    - 换出通过回收链触发 (pmem_register_reclaim), 只在可以睡眠的上下文中工作 (进程上下文且没有持有自旋锁)
+    - 用时钟算法挑选页面: 指针依次扫过各进程的堆、私有 mmap 区域和栈,
+      PTE_A 被置位的页面清除 PTE_A 后获得第二次机会, 没有被置位的页面被换出
+    - 只换出只有一个引用的4KB页面 (大页、共享内存、写时复制和 KSM 共享的页面不换出)
+    - 与 KSM 相同, 只处理当前进程或者从用户态让出CPU、等待运行的进程
+*/
+#define SWAP_MAX_SLOTS 4096 // 交换槽位数量 (16MB)
+#define SWAP_SCAN_MAX 1024  // 挑选一个换出页面时最多检查的页面数
 
-/* 最大支持256个mmap_region_node */
-#define N_MMAP 256
+#define PTE_TO_SLOT(pte) ((uint32)((pte) >> 10))
+#define SLOT_TO_PTE(slot, flags) (((uint64)(slot) << 10) | PTE_SWAP | (flags))
 
 // 映射区域的终点 (给ustack留16MB内存空间)
 #define MMAP_END (TRAPFRAME - 16 * 256 * PGSIZE)
@@ -4,6 +4,94 @@
  * Part 1: 用户空间与内核空间的数据传输
  * ------------------------------------------------------------------------- */
 
+/*
+ * 辅助函数：获取当前进程用户地址 va 对应的 PTE
+ * 页面尚未分配时按缺页处理, 需要写入时先解除写时复制
+ * level: 输出 PTE 所在的层级 (大页的 PTE 位于中间层, 需要加上块内偏移)
+ * 失败返回 NULL 或者无效的 PTE, 由调用者报错
+ */
+static pte_t *user_getpte(pgtbl_t user_tbl, uint64 va, bool is_write, int *level)
+{
+    pte_t *pte = vm_getleaf(user_tbl, va, level);
+    proc_t *p = myproc();
+
+    // 只有当前进程的页表才能按需分配
+    if (p != NULL && p->pgtbl == user_tbl &&
+        (pte == NULL || !(*pte & PTE_V) || (is_write && (*pte & PTE_COW)))) {
+        if (uvm_fault(p, va, is_write) != 0)
+            return NULL;
+        pte = vm_getleaf(user_tbl, va, level);
+    }
+    return pte;
+}
+
+// 辅助函数：PTE 是否有效、用户可访问并且具有 perm 要求的权限
+static bool user_pte_ok(pte_t *pte, int perm)
+{
+    return pte != NULL && (*pte & (PTE_V | PTE_U | perm)) == (PTE_V | PTE_U | perm);
+}
+
+// 辅助函数：拷贝积累的一段 (物理地址 pa 开始的 *len 字节), 随后推进内核地址并清空这一段
+static void user_copy_run(uint64 pa, uint64 *kaddr, uint64 *len, bool to_user)
+{
+    if (*len == 0)
+        return;
+    if (to_user)
+        memmove((void *)pa, (void *)*kaddr, *len);
+    else
+        memmove((void *)*kaddr, (void *)pa, *len);
+    *kaddr += *len;
+    *len = 0;
+}
+
+/*
+ * 辅助函数：在用户地址 uva 和内核地址 kaddr 之间拷贝 len 字节, to_user 决定方向
+ * 内核运行在自己的页表上 (内核栈占用了用户栈的虚拟地址), 无法借助 SUM 直接访问用户地址,
+ * 因此通过物理内存的直接映射访问用户页面:
+ *   每张低级页表只从根查询一次, 之后直接读取同一张页表中相邻的 PTE,
+ *   只有 PTE 无效或者权限不足 (未分配、写时复制) 时才重新查询并按缺页处理;
+ *   物理上连续的页面合并成一次 memmove
+ * 返回值: 成功返回0, 用户地址无效返回-1
+ */
+static int user_copy(pgtbl_t user_tbl, uint64 uva, uint64 kaddr, uint64 len, bool to_user)
+{
+    int perm = to_user ? PTE_W : PTE_R;
+    pte_t *pte = NULL;              // 上一个4KB页面的 PTE
+    uint64 run_pa = 0, run_len = 0; // 物理上连续、尚未拷贝的一段
+
+    while (len > 0) {
+        int level = 0;
+
+        if (pte != NULL && uva % MEGA_PGSIZE != 0 && user_pte_ok(pte + 1, perm)) {
+            pte++;
+        } else {
+            // 重新查询前先完成已经积累的拷贝 (缺页处理可能改变其他页面)
+            user_copy_run(run_pa, &kaddr, &run_len, to_user);
+            pte = user_getpte(user_tbl, uva, to_user, &level);
+            if (!user_pte_ok(pte, perm))
+                return -1;
+        }
+
+        uint64 offset = uva & (LEVEL_PGSIZE(level) - 1);
+        uint64 pa = PTE_TO_PA(*pte) + offset;
+        uint64 n = MIN(LEVEL_PGSIZE(level) - offset, len);
+        if (level > 0)
+            pte = NULL; // 大页之后的地址属于另一张页表
+
+        // 与正在积累的一段不连续时先拷贝这一段
+        if (run_pa + run_len != pa)
+            user_copy_run(run_pa, &kaddr, &run_len, to_user);
+        if (run_len == 0)
+            run_pa = pa;
+        run_len += n;
+        uva += n;
+        len -= n;
+    }
+
+    user_copy_run(run_pa, &kaddr, &run_len, to_user);
+    return 0;
+}
+
 /*
  * 从用户空间拷贝数据到内核空间 (copy_from_user)
  * pgtbl: 用户页表
@@ -13,32 +101,9 @@
  */
 void uvm_copyin(pgtbl_t user_tbl, uint64 dst, uint64 src, uint32 len)
 {
-    uint64 copied_bytes = 0;
-    
-    while (copied_bytes < len) {
-        uint64 va = src + copied_bytes;
-        uint64 page_offset = va % PGSIZE;
-        
-        // 查找用户地址对应的 PTE
-        pte_t *pte = vm_getpte(user_tbl, va, false);
-        
-        // 权限检查：必须有效(V)、可读(R)、用户可访问(U)
-        if (pte == NULL || !(*pte & PTE_V) || !(*pte & PTE_R) || !(*pte & PTE_U)) {
-            panic("uvm_copyin: access violation or unmapped addr");
-        }
-        
-        uint64 pa = PTE_TO_PA(*pte);
-        uint64 bytes_this_page = PGSIZE - page_offset;
-        uint64 remaining = len - copied_bytes;
-        
-        // 本次拷贝取“页剩余空间”和“总剩余长度”的较小值
-        uint64 n = (bytes_this_page < remaining) ? bytes_this_page : remaining;
-        
-        // 执行拷贝
-        memmove((void *)(dst + copied_bytes), (void *)(pa + page_offset), n);
-        
-        copied_bytes += n;
-    }
+    // 权限检查：必须有效(V)、可读(R)、用户可访问(U)
+    if (user_copy(user_tbl, src, dst, len, false) < 0)
+        panic("uvm_copyin: access violation or unmapped addr");
 }
 
 /*
@@ -50,29 +115,9 @@ void uvm_copyin(pgtbl_t user_tbl, uint64 dst, uint64 src, uint32 len)
  */
 void uvm_copyout(pgtbl_t user_tbl, uint64 dst, uint64 src, uint32 len)
 {
-    uint64 copied_bytes = 0;
-    
-    while (copied_bytes < len) {
-        uint64 va = dst + copied_bytes;
-        uint64 page_offset = va % PGSIZE;
-        
-        pte_t *pte = vm_getpte(user_tbl, va, false);
-        
-        // 权限检查：必须有效(V)、可写(W)、用户可访问(U)
-        if (pte == NULL || !(*pte & PTE_V) || !(*pte & PTE_W) || !(*pte & PTE_U)) {
-            panic("uvm_copyout: access violation or unmapped addr");
-        }
-        
-        uint64 pa = PTE_TO_PA(*pte);
-        uint64 bytes_this_page = PGSIZE - page_offset;
-        uint64 remaining = len - copied_bytes;
-        
-        uint64 n = (bytes_this_page < remaining) ? bytes_this_page : remaining;
-        
-        memmove((void *)(pa + page_offset), (void *)(src + copied_bytes), n);
-        
-        copied_bytes += n;
-    }
+    // 权限检查：必须有效(V)、可写(W)、用户可访问(U); 必要时分配页面或者复制出私有页面
+    if (user_copy(user_tbl, dst, src, len, true) < 0)
+        panic("uvm_copyout: access violation or unmapped addr");
 }
 
 /*
@@ -88,15 +133,15 @@ void uvm_copyin_str(pgtbl_t user_tbl, uint64 dst, uint64 src, uint32 maxlen)
     
     while (n < maxlen) {
         uint64 va = src + n;
-        pte_t *pte = vm_getpte(user_tbl, va, false);
+        int level;
+        pte_t *pte = user_getpte(user_tbl, va, false, &level);
         
-        if (pte == NULL || !(*pte & PTE_V) || !(*pte & PTE_R) || !(*pte & PTE_U)) {
+        if (!user_pte_ok(pte, PTE_R)) {
             panic("uvm_copyin_str: invalid user string ptr");
         }
         
-        uint64 pa = PTE_TO_PA(*pte);
         uint64 offset = va % PGSIZE;
-        char *p_str = (char *)(pa + offset);
+        char *p_str = (char *)(PTE_TO_PA(*pte) + ALIGN_DOWN(va & (LEVEL_PGSIZE(level) - 1), PGSIZE) + offset);
         
         // 逐字节拷贝直到页边界或遇到 '\0'
         while (n < maxlen && offset < PGSIZE) {
@@ -115,57 +160,135 @@ void uvm_copyin_str(pgtbl_t user_tbl, uint64 dst, uint64 src, uint32 maxlen)
     k_dst[maxlen - 1] = '\0';
 }
 
+#ifdef MEM_BENCH
+// 拷贝基准的对照: 每个页面都从根查询一次, 每个页面一次 memmove (user_copy 之前的做法)
+static void copy_bench_per_page(pgtbl_t tbl, uint64 uva, uint64 kaddr, uint64 len)
+{
+    for (uint64 off = 0; off < len; off += PGSIZE) {
+        pte_t *pte = vm_getpte(tbl, uva + off, false);
+        memmove((void *)PTE_TO_PA(*pte), (void *)(kaddr + off), PGSIZE);
+    }
+}
+
+// 辅助函数: 输出一种拷贝方式每轮的平均周期数
+static void copy_bench_report(char *name, uint64 len, uint64 cycles, int rounds)
+{
+    printf("copy_bench: %s %d bytes, %d cycles/copy\n", name, (int)len, (int)(cycles / rounds));
+}
+
+/*
+ * 微基准测试: 向用户页表拷贝 64KB 的开销 (make MEMBENCH=1)
+ * 对照逐页查询和拷贝, user_copy 拷贝物理上不连续的页面 (只节省页表查询),
+ * 以及 user_copy 拷贝物理上连续的页面 (同时合并成一次 memmove)
+ */
+void uvm_copy_bench()
+{
+    const int npages = 16, rounds = 64;
+    uint64 len = (uint64)npages * PGSIZE;
+    uint64 scattered = USER_BASE;                 // 逆序映射单独申请的页面
+    uint64 contiguous = USER_BASE + MEGA_PGSIZE;  // 顺序映射一个 order 4 的块
+    uint64 pages[16];
+
+    pgtbl_t tbl = (pgtbl_t)pmem_alloc(true);
+    void *kbuf = pmem_alloc_order(4, true);
+    uint64 block = (uint64)pmem_alloc_order(4, false);
+    if (tbl == NULL || kbuf == NULL || block == 0)
+        panic("uvm_copy_bench: alloc failed");
+    pmem_split_order(block, 4); // 之后按单页释放
+
+    for (int i = 0; i < npages; i++) {
+        pages[i] = (uint64)pmem_alloc(false);
+        if (pages[i] == 0)
+            panic("uvm_copy_bench: alloc failed");
+    }
+    for (int i = 0; i < npages; i++) {
+        if (vm_mappages(tbl, scattered + (uint64)i * PGSIZE, pages[npages - 1 - i], PGSIZE, PTE_R | PTE_W | PTE_U) < 0 ||
+            vm_mappages(tbl, contiguous + (uint64)i * PGSIZE, block + (uint64)i * PGSIZE, PGSIZE, PTE_R | PTE_W | PTE_U) < 0)
+            panic("uvm_copy_bench: map failed");
+    }
+
+    uint64 begin = r_cycle();
+    for (int i = 0; i < rounds; i++)
+        copy_bench_per_page(tbl, scattered, (uint64)kbuf, len);
+    copy_bench_report("per-page walk", len, r_cycle() - begin, rounds);
+
+    begin = r_cycle();
+    for (int i = 0; i < rounds; i++)
+        user_copy(tbl, scattered, (uint64)kbuf, len, true);
+    copy_bench_report("user_copy scattered", len, r_cycle() - begin, rounds);
+
+    begin = r_cycle();
+    for (int i = 0; i < rounds; i++)
+        user_copy(tbl, contiguous, (uint64)kbuf, len, true);
+    copy_bench_report("user_copy contiguous", len, r_cycle() - begin, rounds);
+
+    // 释放映射的页面和页表, 再释放内核缓冲区
+    uvm_destroy_pgtbl(tbl);
+    pmem_free_order((uint64)kbuf, 4, true);
+}
+#endif
+
 /* -------------------------------------------------------------------------
- * Part 2: mmap 区域管理 (链表 + 映射)
+ * Part 2: mmap 区域管理 (区域树 + 映射)
  * ------------------------------------------------------------------------- */
 
-// 调试工具：打印进程的 mmap 链表
-void uvm_show_mmaplist(mmap_region_t *head)
+// 调试工具：按地址顺序打印进程的 mmap 区域
+void uvm_show_mmaplist(mmap_region_t *root)
 {
     printf("\n=== Process MMAP List ===\n");
-    mmap_region_t *node = head;
-    while (node) {
+    for (mmap_region_t *node = mmap_tree_find(root, 0); node; node = mmap_tree_find(root, MMAP_REGION_END(node))) {
         printf("[%p - %p] pages=%d\n", 
                node->begin, 
-               node->begin + node->npages * PGSIZE, 
+               MMAP_REGION_END(node), 
                node->npages);
-        node = node->next;
     }
-    if (!head) printf("(empty)\n");
+    if (!root) printf("(empty)\n");
 }
 
-// 辅助函数：寻找一块足够大的虚拟地址空间
-// 如果找到，返回起始地址；否则返回 0
-// 输出参数 out_prev 指向新插入点的前驱节点
-static uint64 find_free_region(mmap_region_t *head, uint32 npages, mmap_region_t **out_prev)
+/*
+ * 辅助函数：尝试用一个大页映射 mmap 区域中 va 所在的2MB对齐块
+ * 只有整个块都在区域内、块内还没有任何映射、并且有连续的物理内存时才会成功
+ * 返回值: 成功返回0, 否则返回-1 (调用者退回逐页映射)
+ */
+static int mmap_try_megapage(pgtbl_t tbl, mmap_region_t *m, uint64 va)
 {
-    uint64 req_len = npages * PGSIZE;
-    uint64 candidate_start = MMAP_BEGIN;
-    
-    mmap_region_t *curr = head;
-    mmap_region_t *prev = NULL;
-    
-    // 遍历链表寻找空隙
-    while (curr != NULL) {
-        // 检查 [candidate_start, curr->begin) 是否够大
-        if (curr->begin >= candidate_start + req_len) {
-            if (out_prev) *out_prev = prev;
-            return candidate_start;
-        }
-        
-        // 移动候选起始点到当前区域之后
-        candidate_start = curr->begin + curr->npages * PGSIZE;
-        prev = curr;
-        curr = curr->next;
+    uint64 mva = ALIGN_DOWN(va, MEGA_PGSIZE);
+    if (mva < m->begin || mva + MEGA_PGSIZE > m->begin + (uint64)m->npages * PGSIZE)
+        return -1;
+    if (!vm_mega_slot_free(tbl, mva))
+        return -1;
+
+    void *mem = pmem_alloc_order(9, false); // 已清零
+    if (mem == NULL)
+        return -1;
+    if (vm_mappages_mega(tbl, mva, (uint64)mem, MEGA_PGSIZE, m->perm) < 0) {
+        pmem_free_order((uint64)mem, 9, false);
+        return -1;
     }
-    
-    // 检查最后一个区域之后是否有空间
-    if (candidate_start + req_len <= MMAP_END) {
-        if (out_prev) *out_prev = prev;
-        return candidate_start;
+    return 0;
+}
+
+/*
+ * 辅助函数：确定新映射的起始地址
+ * start 为0时沿区域树寻找最低的足够大的空隙, 否则检查指定的地址范围是否可用
+ * 返回值: 映射的起始地址, 越界、与已有区域重叠或者没有足够大的空隙时返回0
+ */
+static uint64 mmap_pick_addr(proc_t *p, uint64 start, uint64 len)
+{
+    if (start == 0) {
+        // 自动分配模式
+        return mmap_tree_gap(p->mmap, len);
     }
-    
-    return 0; // 无空间
+
+    // 指定地址模式: 检查越界 (避免 start + len 溢出)
+    if (start < MMAP_BEGIN || start > MMAP_END || len > MMAP_END - start)
+        return 0;
+        
+    // 检查是否与已有区域重叠
+    mmap_region_t *curr = mmap_tree_find(p->mmap, start);
+    if (curr && curr->begin < start + len)
+        return 0;
+    return start;
 }
 
 /*
@@ -173,182 +296,194 @@ static uint64 find_free_region(mmap_region_t *head, uint32 npages, mmap_region_t
  * start: 建议起始地址 (0表示自动分配)
  * npages: 页面数量
  * perm: 权限标志
+ * populate: 是否立即分配并映射所有页面 (否则只保留地址范围, 访问时由缺页处理分配)
+ * 返回值: 成功返回映射的起始地址, 地址范围不可用或者内存不足返回-1 (此时不留下任何映射)
  */
-void uvm_mmap(uint64 start, uint32 npages, int perm)
+uint64 uvm_mmap(uint64 start, uint32 npages, int perm, bool populate)
 {
     proc_t *p = myproc();
-    mmap_region_t *prev_node = NULL;
-    uint64 map_addr;
+    uint64 map_len = (uint64)npages * PGSIZE;
     
     // 1. 确定映射地址
-    if (start == 0) {
-        // 自动分配模式
-        map_addr = find_free_region(p->mmap, npages, &prev_node);
-        if (map_addr == 0) panic("uvm_mmap: out of virtual memory");
-    } else {
-        // 指定地址模式
-        map_addr = start;
-        uint64 map_end = start + npages * PGSIZE;
-        
-        // 检查越界
-        if (map_addr < MMAP_BEGIN || map_end > MMAP_END) 
-            panic("uvm_mmap: invalid address range");
-            
-        // 寻找插入位置 (保持链表有序)
-        mmap_region_t *curr = p->mmap;
-        while (curr && curr->begin < map_addr) {
-            // 检查是否与当前节点重叠
-            if (curr->begin + curr->npages * PGSIZE > map_addr)
-                panic("uvm_mmap: overlap detected");
-            prev_node = curr;
-            curr = curr->next;
-        }
-        // 检查是否与后一个节点重叠
-        if (curr && map_end > curr->begin)
-            panic("uvm_mmap: overlap detected");
-    }
+    uint64 map_addr = mmap_pick_addr(p, start, map_len);
+    if (map_addr == 0)
+        return (uint64)-1;
     
-    // 2. 创建并插入节点
+    // 2. 先申请节点, 失败时区域树和页表都还没有被修改
     mmap_region_t *new_node = mmap_region_alloc();
+    if (new_node == NULL)
+        return (uint64)-1;
     new_node->begin = map_addr;
     new_node->npages = npages;
+    new_node->perm = perm;
     
-    // 插入链表
-    if (prev_node == NULL) {
-        // 插在头部
-        new_node->next = p->mmap;
-        p->mmap = new_node;
-    } else {
-        // 插在中间或尾部
-        new_node->next = prev_node->next;
-        prev_node->next = new_node;
-    }
-    
-    // 3. 尝试合并 (Merge)
-    // 检查是否可以与 后一个节点 合并
-    if (new_node->next) {
-        mmap_region_t *next_node = new_node->next;
-        uint64 my_end = new_node->begin + new_node->npages * PGSIZE;
-        if (my_end == next_node->begin) {
-            new_node->npages += next_node->npages;
-            new_node->next = next_node->next;
-            mmap_region_free(next_node);
+    // 3. 需要时立即分配物理内存并建立页表映射, 失败时撤销已经建立的映射
+    // 按2MB对齐的部分优先使用大页
+    uint64 va = map_addr;
+    uint64 map_end = map_addr + map_len;
+    while (populate && va < map_end) {
+        if (va % MEGA_PGSIZE == 0 && mmap_try_megapage(p->pgtbl, new_node, va) == 0) {
+            va += MEGA_PGSIZE;
+            continue;
         }
-    }
-    // 检查是否可以与 前一个节点 合并
-    if (prev_node) {
-        uint64 prev_end = prev_node->begin + prev_node->npages * PGSIZE;
-        if (prev_end == new_node->begin) {
-            prev_node->npages += new_node->npages;
-            prev_node->next = new_node->next;
+
+        void *pa = pmem_alloc(false); // 分配用户物理页 (已清零)
+        if (!pa || vm_mappages(p->pgtbl, va, (uint64)pa, PGSIZE, perm) < 0) {
+            if (pa) pmem_free((uint64)pa, false);
+            if (va > map_addr)
+                vm_unmappages(p->pgtbl, map_addr, va - map_addr, true);
             mmap_region_free(new_node);
-            // 如果发生了前向合并，new_node 实际上变成了 prev_node
-            // 但这里的逻辑已经结束，不需要更新 new_node 指针
+            return (uint64)-1;
         }
+        va += PGSIZE;
     }
     
-    // 4. 分配物理内存并建立页表映射
-    uint64 va = map_addr;
-    for (int i = 0; i < npages; i++) {
-        void *pa = pmem_alloc(false); // 分配用户物理页
-        if (!pa) panic("uvm_mmap: pmem alloc failed");
-        
-        memset(pa, 0, PGSIZE); // 清零
-        vm_mappages(p->pgtbl, va, (uint64)pa, PGSIZE, perm);
-        va += PGSIZE;
+    // 4. 尝试与相邻且权限相同的区域合并 (Merge), 再插入区域树
+    // 后一个区域: 结束地址大于 map_end 的第一个区域恰好从 map_end 开始
+    mmap_region_t *next_node = mmap_tree_find(p->mmap, map_end);
+    if (next_node && next_node->begin == map_end && next_node->perm == perm && !next_node->shared) {
+        mmap_tree_remove(&p->mmap, next_node);
+        new_node->npages += next_node->npages;
+        mmap_region_free(next_node);
+    }
+    // 前一个区域: 包含 map_addr - 1 的区域
+    mmap_region_t *prev_node = mmap_tree_find(p->mmap, map_addr - 1);
+    if (prev_node && MMAP_REGION_END(prev_node) == map_addr && prev_node->perm == perm && !prev_node->shared) {
+        mmap_tree_remove(&p->mmap, prev_node);
+        prev_node->npages += new_node->npages;
+        mmap_region_free(new_node);
+        new_node = prev_node;
+    }
+    mmap_tree_insert(&p->mmap, new_node);
+
+    return map_addr;
+}
+
+/*
+ * 把共享内存对象的页面映射到当前进程 (由 shm_map 调用, 调用者持有 shm 锁)
+ * start: 建议起始地址 (0表示自动分配)
+ * pages: 对象的物理页地址表, 每个映射持有每个页面的一个引用
+ * 共享区域立即映射所有页面, 不与相邻区域合并, fork 时保持共享而不是写时复制
+ * 返回值: 成功返回映射的起始地址, 地址范围不可用或者内存不足返回-1 (此时不留下任何映射)
+ */
+uint64 uvm_mmap_shared(uint64 start, uint32 npages, uint64 *pages)
+{
+    proc_t *p = myproc();
+    uint64 map_len = (uint64)npages * PGSIZE;
+    uint64 map_addr = mmap_pick_addr(p, start, map_len);
+    int perm = PTE_R | PTE_W | PTE_U;
+
+    // 地址来自用户程序, 不可用时返回错误而不是 panic
+    if (map_addr == 0)
+        return (uint64)-1;
+
+    mmap_region_t *node = mmap_region_alloc();
+    if (node == NULL)
+        return (uint64)-1;
+    node->begin = map_addr;
+    node->npages = npages;
+    node->perm = perm;
+    node->shared = true;
+
+    for (uint32 i = 0; i < npages; i++) {
+        uint64 va = map_addr + (uint64)i * PGSIZE;
+        if (vm_mappages(p->pgtbl, va, pages[i], PGSIZE, perm) < 0) {
+            // 撤销已经建立的映射, 同时归还它们持有的引用
+            if (i > 0)
+                vm_unmappages(p->pgtbl, map_addr, (uint64)i * PGSIZE, true);
+            mmap_region_free(node);
+            return (uint64)-1;
+        }
+        pmem_get(pages[i]);
     }
+
+    mmap_tree_insert(&p->mmap, node);
+    return map_addr;
 }
 
 /*
  * 解除内存映射
  * start: 起始地址
  * npages: 页面数量
+ * 返回值: 成功返回0, 中间打洞需要的新节点或者拆分大页需要的页表页申请失败返回-1 (此时不做任何修改)
  */
-void uvm_munmap(uint64 start, uint32 npages)
+int uvm_munmap(uint64 start, uint32 npages)
 {
     proc_t *p = myproc();
     uint64 unmap_end = start + npages * PGSIZE;
     
     if (start < MMAP_BEGIN || unmap_end > MMAP_END)
         panic("uvm_munmap: address out of range");
-        
-    mmap_region_t *walker = p->mmap;
-    mmap_region_t *prev = NULL;
+
+    // 中间打洞需要一个新节点, 必须在修改页表之前申请
+    // 只有包含 start 的区域同时越过 unmap_end 时才会打洞, 此时它是唯一受影响的区域
+    mmap_region_t *walker = mmap_tree_find(p->mmap, start);
+    mmap_region_t *split_node = NULL;
+    if (walker && walker->begin < start && MMAP_REGION_END(walker) > unmap_end) {
+        split_node = mmap_region_alloc();
+        if (split_node == NULL)
+            return -1;
+    }
+
+    // 解除范围的两端落在大页中间时, 先把大页拆成普通页面
+    // 同样必须在解除任何映射之前完成: 拆分只改变映射的粒度, 失败时进程看到的映射仍然不变
+    // 区域的边界不会落在大页中间, 所以只有 start 和 unmap_end 两处需要拆分
+    if ((start % MEGA_PGSIZE != 0 && vm_split(p->pgtbl, start) < 0) ||
+        (unmap_end % MEGA_PGSIZE != 0 && vm_split(p->pgtbl, unmap_end) < 0)) {
+        mmap_region_free(split_node);
+        return -1;
+    }
     
-    while (walker) {
-        uint64 region_end = walker->begin + walker->npages * PGSIZE;
-        
-        // 检查区间是否有交集
-        // 无交集的情况：请求区间在当前节点之前，或者在当前节点之后
-        if (unmap_end <= walker->begin) {
-            // 因为链表有序，如果请求结束点在当前节点开始点之前，后续都不可能相交
-            break; 
-        }
-        if (start >= region_end) {
-            prev = walker;
-            walker = walker->next;
-            continue;
-        }
+    // 依次处理所有与 [start, unmap_end) 相交的区域
+    // 每处理完一个区域, 它都不再包含 start 之后的地址, 重新查找即可得到下一个区域
+    for (; walker && walker->begin < unmap_end; walker = mmap_tree_find(p->mmap, start)) {
+        uint64 region_begin = walker->begin;
+        uint64 region_end = MMAP_REGION_END(walker);
         
-        // 有交集，计算实际需要解映射的范围
-        uint64 overlap_start = (start > walker->begin) ? start : walker->begin;
+        // 计算实际需要解映射的范围
+        uint64 overlap_start = (start > region_begin) ? start : region_begin;
         uint64 overlap_end = (unmap_end < region_end) ? unmap_end : region_end;
         uint64 overlap_len = overlap_end - overlap_start;
-        
+
         // 1. 执行页表解映射和物理页释放
         vm_unmappages(p->pgtbl, overlap_start, overlap_len, true);
         
-        // 2. 更新链表节点结构
+        // 2. 更新区域树 (修改节点前先把它从树中删除)
+        mmap_tree_remove(&p->mmap, walker);
+
         // Case A: 完全覆盖 (Remove Node)
-        if (start <= walker->begin && unmap_end >= region_end) {
-            mmap_region_t *victim = walker;
-            if (prev) prev->next = walker->next;
-            else p->mmap = walker->next;
-            
-            walker = walker->next; // 移动到下一个，继续检查（虽然理论上只应有一个重叠，但为了健壮）
-            mmap_region_free(victim);
-            continue; // prev 保持不变
+        if (start <= region_begin && unmap_end >= region_end) {
+            mmap_region_free(walker);
+            continue;
         }
         
         // Case B: 头部截断 (Trim Head) -> start <= begin < end < region_end
-        // 请求解映射的范围覆盖了节点的头部，但没覆盖尾部
-        else if (start <= walker->begin && unmap_end < region_end) {
-            uint32 cut_pages = (unmap_end - walker->begin) / PGSIZE;
+        // 请求解映射的范围覆盖了节点的头部，但没覆盖尾部; 后续区域地址更高, 处理完毕
+        if (start <= region_begin) {
             walker->begin = unmap_end;
-            walker->npages -= cut_pages;
-            // 处理完毕，无需继续，因为后续节点地址更高
+            walker->npages = (region_end - unmap_end) / PGSIZE;
+            mmap_tree_insert(&p->mmap, walker);
             break;
         }
         
         // Case C: 尾部截断 (Trim Tail) -> begin < start < region_end <= end
         // 请求解映射的范围覆盖了节点的尾部，但没覆盖头部
-        else if (start > walker->begin && unmap_end >= region_end) {
-            uint32 cut_pages = (region_end - start) / PGSIZE;
-            walker->npages -= cut_pages;
-            // 继续检查下一个节点（虽然一般只有这一个）
-            prev = walker;
-            walker = walker->next;
-            continue; 
-        }
+        walker->npages = (start - region_begin) / PGSIZE;
+        mmap_tree_insert(&p->mmap, walker);
+        if (unmap_end >= region_end)
+            continue;
         
         // Case D: 中间打洞 (Split) -> begin < start < end < region_end
-        // 请求范围完全在节点内部
-        else {
-            // 分裂成两个节点：前部分 + 后部分
-            // 创建后半部分节点
-            mmap_region_t *new_node = mmap_region_alloc();
-            new_node->begin = unmap_end;
-            new_node->npages = (region_end - unmap_end) / PGSIZE;
-            new_node->next = walker->next;
-            
-            // 修改当前节点为前半部分
-            walker->npages = (start - walker->begin) / PGSIZE;
-            walker->next = new_node;
-            
-            // 打洞必定只影响这一个节点，处理完毕
-            break;
-        }
+        // 当前节点已经成为前半部分, 再插入后半部分
+        split_node->begin = unmap_end;
+        split_node->npages = (region_end - unmap_end) / PGSIZE;
+        split_node->perm = walker->perm;
+        split_node->shared = walker->shared;
+        mmap_tree_insert(&p->mmap, split_node);
+        break;
     }
+
+    return 0;
 }
 
 /* -------------------------------------------------------------------------
@@ -356,27 +491,32 @@ void uvm_munmap(uint64 start, uint32 npages)
  * ------------------------------------------------------------------------- */
 
 // 堆增长
-uint64 uvm_heap_grow(pgtbl_t tbl, uint64 current_top, uint32 bytes)
+// 默认只扩大堆的地址范围, 物理页在第一次访问时由缺页处理分配
+// populate 为 true 时立即为新增的页面分配全0页面并建立映射
+// 返回值: 新的堆顶, 越界或者内存不足返回-1 (此时不留下新的映射)
+uint64 uvm_heap_grow(pgtbl_t tbl, uint64 current_top, uint32 bytes, bool populate)
 {
     if (bytes == 0) return current_top;
     
     uint64 new_top = current_top + bytes;
     if (new_top > MMAP_BEGIN) return (uint64)-1; // 防止堆撞上 MMAP 区
-    
-    // 按页对齐进行分配
-    // 对齐后的当前页结束
-    uint64 page_aligned_curr = (current_top + PGSIZE - 1) & ~(PGSIZE - 1);
-    // 对齐后的新页结束
-    uint64 page_aligned_new = (new_top + PGSIZE - 1) & ~(PGSIZE - 1);
-    
-    for (uint64 va = page_aligned_curr; va < page_aligned_new; va += PGSIZE) {
-        void *mem = pmem_alloc(false);
-        if (!mem) {
-            // 回滚：释放已分配的
-            uvm_heap_ungrow(tbl, va, va - page_aligned_curr);
+    if (!populate) return new_top;
+
+    // 原堆顶所在的页面可能已经被访问过, 从第一个尚未映射的页面开始
+    int perm = PTE_R | PTE_W | PTE_U;
+    uint64 begin = ALIGN_DOWN(current_top, PGSIZE);
+    pte_t *pte = vm_getpte(tbl, begin, false);
+    if (pte != NULL && (*pte & (PTE_V | PTE_SWAP)))
+        begin += PGSIZE;
+
+    for (uint64 va = begin; va < new_top; va += PGSIZE) {
+        void *pa = pmem_alloc(false);
+        if (!pa || vm_mappages(tbl, va, (uint64)pa, PGSIZE, perm) < 0) {
+            if (pa) pmem_free((uint64)pa, false);
+            if (va > begin)
+                vm_unmappages(tbl, begin, va - begin, true);
             return (uint64)-1;
         }
-        vm_mappages(tbl, va, (uint64)mem, PGSIZE, PTE_R | PTE_W | PTE_U);
     }
     
     return new_top;
@@ -430,14 +570,14 @@ uint64 uvm_ustack_grow(pgtbl_t tbl, uint64 current_pages, uint64 fault_addr)
     for (int i = 0; i < pages_needed; i++) {
         uint64 va = current_bottom - (i + 1) * PGSIZE;
         void *mem = pmem_alloc(false);
-        if (!mem) {
+        if (!mem || vm_mappages(tbl, va, (uint64)mem, PGSIZE, PTE_R | PTE_W | PTE_U) < 0) {
             // 分配失败，回滚（释放刚刚分配的）
+            if (mem) pmem_free((uint64)mem, false);
             if (i > 0) {
                 vm_unmappages(tbl, va + PGSIZE, i * PGSIZE, true);
             }
             return (uint64)-1;
         }
-        vm_mappages(tbl, va, (uint64)mem, PGSIZE, PTE_R | PTE_W | PTE_U);
     }
     
     return current_pages + pages_needed;
@@ -455,9 +595,14 @@ static void free_pagetable_recursive(pgtbl_t tbl, int level)
         if (pte & PTE_V) {
             uint64 child_pa = PTE_TO_PA(pte);
             
-            if (level > 0) {
+            if (level > 0 && PTE_CHECK(pte)) {
                 // 中间层：递归释放下一级页表
                 free_pagetable_recursive((pgtbl_t)child_pa, level - 1);
+            } else if (level > 0) {
+                // 中间层的叶子：用户大页整体释放
+                if (pte & PTE_U) {
+                    pmem_free_order(child_pa, 9 * level, false);
+                }
             } else {
                 // 叶子层：如果是用户页 (PTE_U)，则释放物理内存
                 // 内核共享页 (如 trampoline) 不释放
@@ -465,6 +610,9 @@ static void free_pagetable_recursive(pgtbl_t tbl, int level)
                     pmem_free(child_pa, false);
                 }
             }
+        } else if (level == 0 && (pte & PTE_SWAP)) {
+            // 叶子层的换出项：归还交换槽位
+            swap_put(PTE_TO_SLOT(pte));
         }
     }
     // 释放当前页表页本身
@@ -485,53 +633,359 @@ void uvm_destroy_pgtbl(pgtbl_t tbl)
     free_pagetable_recursive(tbl, 2); // SV39 顶层为 level 2
 }
 
-// 辅助：拷贝一段虚拟地址范围的内存
-static int copy_virt_range(pgtbl_t src_tbl, pgtbl_t dst_tbl, uint64 start, uint64 end)
+// 辅助：让子进程共享一段虚拟地址范围的物理页 (写时复制)
+// 可写页面在父子双方都改成只读并打上 PTE_COW 标记, 第一次写入时再复制
+// 整个落在范围内的大页以大页的形式共享, 父子进程都保留大页映射
+// 父进程失去写权限的页面需要刷新 TLB
+// cow 为 false 时 (共享内存区域) 保持原有权限, 父子进程继续写同一组页面
+static int share_virt_range(pgtbl_t src_tbl, pgtbl_t dst_tbl, uint64 start, uint64 end, bool cow)
 {
     for (uint64 va = start; va < end; va += PGSIZE) {
-        pte_t *src_pte = vm_getpte(src_tbl, va, false);
-        if (!src_pte || !(*src_pte & PTE_V)) 
-            panic("uvm_copy: source pte missing");
+        // 尚未访问过的页面没有映射, 子进程访问时自己缺页分配
+        int level;
+        pte_t *src_pte = vm_getleaf(src_tbl, va, &level);
+        if (!src_pte)
+            continue;
+
+        if (level > 0) {
+            // 大页整体共享, 子进程持有整个块的一个引用
+            if (va % MEGA_PGSIZE == 0 && end - va >= MEGA_PGSIZE) {
+                uint64 pa = PTE_TO_PA(*src_pte);
+                if (cow && (*src_pte & PTE_W))
+                    *src_pte = (*src_pte & ~PTE_W) | PTE_COW;
+                if (vm_mappages_mega(dst_tbl, va, pa, MEGA_PGSIZE, PTE_FLAGS(*src_pte)) < 0) {
+                    vm_flush(src_tbl, start, end - start);
+                    return -1;
+                }
+                pmem_get(pa);
+                va += MEGA_PGSIZE - PGSIZE;
+                continue;
+            }
+            // 只有一部分在范围内的大页 (区域边界不会落在大页中间, 正常情况下不会出现) 先拆成普通页面
+            if (vm_split(src_tbl, va) < 0) {
+                vm_flush(src_tbl, start, end - start);
+                return -1;
+            }
+            src_pte = vm_getpte(src_tbl, va, false);
+        }
+
+        // 已换出的页面: 子进程复制换出项, 双方换入时各自得到私有页面
+        if (!(*src_pte & PTE_V) && (*src_pte & PTE_SWAP)) {
+            pte_t *dst_pte = vm_getpte(dst_tbl, va, true);
+            if (dst_pte == NULL) {
+                vm_flush(src_tbl, start, end - start);
+                return -1;
+            }
+            swap_dup(PTE_TO_SLOT(*src_pte));
+            *dst_pte = *src_pte;
+            continue;
+        }
+        if (!(*src_pte & PTE_V))
+            continue;
             
-        uint64 src_pa = PTE_TO_PA(*src_pte);
+        uint64 pa = PTE_TO_PA(*src_pte);
+        if (cow && (*src_pte & PTE_W))
+            *src_pte = (*src_pte & ~PTE_W) | PTE_COW;
         int flags = PTE_FLAGS(*src_pte);
         
-        // 分配新物理页
-        void *dst_pa = pmem_alloc(false);
-        if (!dst_pa) return -1;
-        
-        // 深拷贝内存内容
-        memmove(dst_pa, (void *)src_pa, PGSIZE);
-        
-        // 建立新映射
-        vm_mappages(dst_tbl, va, (uint64)dst_pa, PGSIZE, flags);
+        // 建立新映射, 成功后子进程持有该页面的一个引用
+        if (vm_mappages(dst_tbl, va, pa, PGSIZE, flags) < 0) {
+            vm_flush(src_tbl, start, end - start);
+            return -1;
+        }
+        pmem_get(pa);
     }
+    vm_flush(src_tbl, start, end - start);
     return 0;
 }
 
 // 复制父进程的地址空间到子进程 (Fork)
-void uvm_copy_pgtbl(pgtbl_t old_tbl, pgtbl_t new_tbl, uint64 heap_top, uint64 ustack_pages, mmap_region_t *mmap_head)
+// 物理页不会被拷贝, 而是以写时复制的方式共享, fork 的开销只和页表大小有关
+// 返回值: 成功返回0, 内存不足返回-1
+// 失败时已经共享的页面仍然映射在子进程页表中, 由调用者通过释放子进程统一回收
+int uvm_copy_pgtbl(pgtbl_t old_tbl, pgtbl_t new_tbl, uint64 heap_top, uint64 ustack_pages, mmap_region_t *mmap_root)
 {
     // 1. 复制代码段
-    copy_virt_range(old_tbl, new_tbl, USER_BASE, USER_BASE + PGSIZE);
+    if (share_virt_range(old_tbl, new_tbl, USER_BASE, USER_BASE + PGSIZE, true) < 0)
+        return -1;
     
     // 2. 复制堆
     if (heap_top > USER_BASE + PGSIZE) {
         uint64 heap_end = (heap_top + PGSIZE - 1) & ~(PGSIZE - 1);
-        copy_virt_range(old_tbl, new_tbl, USER_BASE + PGSIZE, heap_end);
+        if (share_virt_range(old_tbl, new_tbl, USER_BASE + PGSIZE, heap_end, true) < 0)
+            return -1;
     }
     
     // 3. 复制栈
     if (ustack_pages > 0) {
         uint64 stack_base = TRAPFRAME - ustack_pages * PGSIZE;
-        copy_virt_range(old_tbl, new_tbl, stack_base, TRAPFRAME);
+        if (share_virt_range(old_tbl, new_tbl, stack_base, TRAPFRAME, true) < 0)
+            return -1;
     }
     
     // 4. 复制 mmap 区域
-    mmap_region_t *walker = mmap_head;
-    while (walker) {
-        uint64 end = walker->begin + walker->npages * PGSIZE;
-        copy_virt_range(old_tbl, new_tbl, walker->begin, end);
-        walker = walker->next;
+    for (mmap_region_t *walker = mmap_tree_find(mmap_root, 0); walker;
+         walker = mmap_tree_find(mmap_root, MMAP_REGION_END(walker))) {
+        if (share_virt_range(old_tbl, new_tbl, walker->begin, MMAP_REGION_END(walker), !walker->shared) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/* -------------------------------------------------------------------------
+ * Part 5: 写时复制 (Copy-on-Write)
+ * ------------------------------------------------------------------------- */
+
+/*
+ * 辅助函数：处理对写时复制大页的写入
+ * 大页只剩自己一个使用者时直接恢复写权限, 否则复制出一个私有大页
+ * 申请不到连续的2MB时用 vm_split 复制成512个私有页面, 再按普通页面处理
+ */
+static int uvm_cow_mega(pgtbl_t pgtbl, uint64 va, pte_t *pte)
+{
+    uint64 mva = ALIGN_DOWN(va, MEGA_PGSIZE);
+    uint64 pa = PTE_TO_PA(*pte);
+    int flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+    if (pmem_refcnt(pa) == 1) {
+        *pte = PA_TO_PTE(pa) | flags;
+        vm_flush(pgtbl, mva, MEGA_PGSIZE);
+        return 0;
+    }
+
+    void *mem = pmem_alloc_order(9, false);
+    if (mem == NULL) {
+        if (vm_split(pgtbl, mva) < 0)
+            return -1;
+        return uvm_cow(pgtbl, va);
+    }
+
+    // 与普通页面一样, 申请内存期间大页可能已经变化, 重新读取PTE
+    int level;
+    pte = vm_getleaf(pgtbl, mva, &level);
+    if (pte == NULL || level != 1 || !(*pte & PTE_V) || !(*pte & PTE_COW) || PTE_TO_PA(*pte) != pa) {
+        pmem_free_order((uint64)mem, 9, false);
+        return 0;
+    }
+    flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+    memmove(mem, (void *)pa, MEGA_PGSIZE);
+    *pte = PA_TO_PTE((uint64)mem) | flags;
+    vm_flush(pgtbl, mva, MEGA_PGSIZE);
+    pmem_free_order(pa, 9, false);
+
+    return 0;
+}
+
+/*
+ * 处理对写时复制页面的写入
+ * 页面只剩自己一个使用者时直接恢复写权限, 否则复制出一个私有页面
+ * 返回值: 0 表示已处理 (或者页面在申请内存期间已经变化, 重新访问即可); 1 表示 va 不是写时复制页面; -1 表示内存不足
+ */
+int uvm_cow(pgtbl_t pgtbl, uint64 va)
+{
+    int level;
+    pte_t *pte = vm_getleaf(pgtbl, ALIGN_DOWN(va, PGSIZE), &level);
+    if (pte == NULL || !(*pte & PTE_V) || !(*pte & PTE_U) || !(*pte & PTE_COW))
+        return 1;
+    if (level > 0)
+        return uvm_cow_mega(pgtbl, va, pte);
+
+    uint64 pa = PTE_TO_PA(*pte);
+    int flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+    // 引用计数为1时不会再有其他人共享它 (只有持有者自己 fork 才会增加引用)
+    if (pmem_refcnt(pa) == 1) {
+        *pte = PA_TO_PTE(pa) | flags;
+        vm_flush(pgtbl, ALIGN_DOWN(va, PGSIZE), PGSIZE);
+        return 0;
     }
-}
\ No newline at end of file
+
+    // 复制出私有页面 (马上会被完整覆盖, 不需要清零), 再放弃对共享页面的引用
+    void *mem = pmem_alloc_flags(false, 0);
+    if (mem == NULL)
+        return -1;
+
+    // 申请内存时可能在回收中睡眠, 期间本页面可能被换出或者被KSM替换, 重新读取PTE
+    // 已经不是同一个写时复制页面时直接返回, 重新执行的访存会按新的PTE再次缺页
+    pte = vm_getpte(pgtbl, ALIGN_DOWN(va, PGSIZE), false);
+    if (pte == NULL || !(*pte & PTE_V) || !(*pte & PTE_COW) || PTE_TO_PA(*pte) != pa) {
+        pmem_free((uint64)mem, false);
+        return 0;
+    }
+    flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+    memmove(mem, (void *)pa, PGSIZE);
+    *pte = PA_TO_PTE((uint64)mem) | flags;
+    vm_flush(pgtbl, ALIGN_DOWN(va, PGSIZE), PGSIZE);
+    pmem_free(pa, false);
+
+    return 0;
+}
+
+/* -------------------------------------------------------------------------
+ * Part 6: 缺页处理 (Demand Paging)
+ * ------------------------------------------------------------------------- */
+
+/*
+ * 辅助函数：缺页预取
+ * page_va 已经映射, 把它所在的预取窗口中 [lo, hi) 范围内尚未映射的页面按 perm 映射上
+ * 窗口按自身大小对齐, 不会跨越低级页表, 因此直接修改 page_va 所在页表中相邻的 PTE
+ * 预取是尽力而为的: 内存不足时停止, 不影响缺页本身的处理结果
+ * 返回值: 预取的页面数
+ */
+static uint32 fault_around(proc_t *p, uint64 page_va, uint64 lo, uint64 hi, int perm)
+{
+    uint64 window = (uint64)p->fault_around * PGSIZE;
+    if (p->fault_around <= 1)
+        return 0;
+
+    uint64 begin = MAX(ALIGN_DOWN(page_va, window), lo);
+    uint64 end = MIN(ALIGN_DOWN(page_va, window) + window, hi);
+
+    int level;
+    pte_t *pte = vm_getleaf(p->pgtbl, page_va, &level);
+    if (pte == NULL || level != 0)
+        return 0;
+    pte -= (page_va - begin) / PGSIZE;
+
+    uint32 count = 0;
+    for (uint64 va = begin; va < end; va += PGSIZE, pte++) {
+        if (*pte != 0) // 已有映射或者已换出
+            continue;
+        void *mem = pmem_alloc(false);
+        if (mem == NULL)
+            break;
+        *pte = PA_TO_PTE((uint64)mem) | perm | PTE_V;
+        count++;
+    }
+
+    if (count > 0)
+        vm_flush(p->pgtbl, begin, end - begin);
+    return count;
+}
+
+/*
+ * 处理进程 p 在 va 处的缺页
+ * - 写入写时复制页面: 交给 uvm_cow
+ * - 堆和 mmap 区域中尚未分配的页面: 分配一个全0页面并按区域权限映射, 再预取同一窗口中的相邻页面
+ * - 用户栈下方的地址: 交给 uvm_ustack_grow 连续增长, 一直增长到预取窗口的下边界
+ * 返回值: 0 表示已处理, 可以重新执行访问; -1 表示非法访问或者内存不足
+ */
+int uvm_fault(proc_t *p, uint64 va, bool is_write)
+{
+    uint64 page_va = ALIGN_DOWN(va, PGSIZE);
+    pte_t *pte = vm_getpte(p->pgtbl, page_va, false);
+
+    // 页面已经存在: 只可能是写时复制, 否则是权限错误
+    if (pte != NULL && (*pte & PTE_V)) {
+        // 没有硬件维护 A/D 位的平台上, 被时钟算法清除访问位的页面会缺页, 由软件补上
+        uint64 ad = PTE_A | (is_write ? PTE_D : 0);
+        if ((*pte & ad) != ad && (*pte & (is_write ? PTE_W : PTE_R))) {
+            *pte |= ad;
+            vm_flush(p->pgtbl, page_va, PGSIZE);
+            return 0;
+        }
+        if (is_write && uvm_cow(p->pgtbl, page_va) == 0) {
+            p->nr_faults++;
+            return 0;
+        }
+        return -1;
+    }
+
+    // 页面已换出到磁盘: 读回内存
+    if (pte != NULL && (*pte & PTE_SWAP)) {
+        if (swap_in(p, page_va) < 0)
+            return -1;
+        p->nr_faults++;
+        return 0;
+    }
+
+    // 确定 va 所属的区域以及映射权限
+    int perm = 0;
+    uint64 lo = 0, hi = 0;
+    if (va >= USER_BASE + PGSIZE && va < ALIGN_UP(p->heap_top, PGSIZE)) {
+        perm = PTE_R | PTE_W | PTE_U;
+        lo = USER_BASE + PGSIZE;
+        hi = ALIGN_UP(p->heap_top, PGSIZE);
+    } else if (va >= MMAP_BEGIN && va < MMAP_END) {
+        mmap_region_t *m = mmap_tree_find(p->mmap, va);
+        // 共享区域的页面在映射时已经全部建立, 缺失的页面属于非法访问
+        if (m != NULL && va >= m->begin && !m->shared) {
+            // 整个2MB对齐块都在区域内时优先使用大页 (透明大页)
+            if (mmap_try_megapage(p->pgtbl, m, va) == 0) {
+                p->nr_faults++;
+                p->nr_fault_pages += MEGA_PGSIZE / PGSIZE;
+                return 0;
+            }
+            perm = m->perm;
+            lo = m->begin;
+            hi = MMAP_REGION_END(m);
+        }
+    } else if (va >= MMAP_END && va < TRAPFRAME) {
+        // 先尝试增长到预取窗口的下边界, 失败时只增长到缺页地址
+        uint64 target = MAX(ALIGN_DOWN(va, (uint64)MAX(p->fault_around, 1) * PGSIZE), MMAP_END);
+        uint64 npages = uvm_ustack_grow(p->pgtbl, p->ustack_npage, target);
+        if (npages == (uint64)-1 && target != va)
+            npages = uvm_ustack_grow(p->pgtbl, p->ustack_npage, va);
+        if (npages == (uint64)-1)
+            return -1;
+
+        uint64 needed = (TRAPFRAME - page_va) / PGSIZE - p->ustack_npage;
+        p->nr_faults++;
+        p->nr_fault_pages += npages - p->ustack_npage;
+        if (npages - p->ustack_npage > needed)
+            p->nr_fault_around += npages - p->ustack_npage - needed;
+        p->ustack_npage = npages;
+        return 0;
+    }
+    if (perm == 0)
+        return -1;
+
+    void *mem = pmem_alloc(false);
+    if (mem == NULL)
+        return -1;
+    if (vm_mappages(p->pgtbl, page_va, (uint64)mem, PGSIZE, perm) < 0) {
+        pmem_free((uint64)mem, false);
+        return -1;
+    }
+
+    uint32 extra = fault_around(p, page_va, lo, hi, perm);
+    p->nr_faults++;
+    p->nr_fault_pages += 1 + extra;
+    p->nr_fault_around += extra;
+    return 0;
+}
+
+// 返回进程 p 中不小于 va 的下一个私有匿名页面地址 (依次是堆、私有 mmap 区域、栈), 没有时返回0
+// 供 KSM 扫描和交换的时钟算法遍历进程的地址空间
+uint64 uvm_next_private_va(proc_t *p, uint64 va)
+{
+    uint64 heap_begin = USER_BASE + PGSIZE;
+    uint64 heap_end = ALIGN_UP(p->heap_top, PGSIZE);
+
+    va = MAX(va, heap_begin);
+    if (va < heap_end)
+        return va;
+
+    if (va < MMAP_END) {
+        va = MAX(va, MMAP_BEGIN);
+        for (mmap_region_t *m = mmap_tree_find(p->mmap, va); m != NULL; m = mmap_tree_find(p->mmap, MMAP_REGION_END(m)))
+            if (!m->shared)
+                return MAX(va, m->begin);
+        va = MMAP_END;
+    }
+
+    va = MAX(va, TRAPFRAME - p->ustack_npage * PGSIZE);
+    return (va < TRAPFRAME) ? va : 0;
+}
+
+// 输出进程的缺页统计
+void uvm_fault_stat(proc_t *p)
+{
+    printf("\n=== Page Fault Stat (pid %d) ===\n", p->pid);
+    printf("fault-around window: %d pages\n", p->fault_around);
+    printf("faults handled: %d\n", (int)p->nr_faults);
+    printf("pages mapped: %d (fault-around: %d)\n", (int)p->nr_fault_pages, (int)p->nr_fault_around);
+}
@@ -16,3 +16,21 @@ void proc_sleep(void *sleep_space, spinlock_t *lk); // 进程睡眠
 void proc_wakeup(void *sleep_space);                // 进程唤醒
 void proc_sched();                                  // 进程切换到调度器
 void proc_scheduler();                              // 调度器选择合适的进程执行
+proc_t *proc_get(int idx);                          // 按下标获取进程池中的进程
+#ifdef WAKE_BENCH
+void proc_wake_bench();                             // 微基准测试: proc_wakeup 的平均开销
+#endif
+
+// sched.c: 每个CPU的就绪队列
+
+void sched_init();                                  // 就绪队列初始化
+void sched_enqueue(proc_t *p);                      // 进程变为RUNNABLE后加入就绪队列
+void sched_wakeup(proc_t *p);                       // 睡眠的进程被唤醒后加入就绪队列
+void sched_charge(proc_t *p);                       // 结算进程的运行时间
+void sched_block(proc_t *p);                        // 进程即将睡眠
+void sched_start(proc_t *p);                        // 调度器即将运行进程
+bool sched_tick(bool tick);                         // 时钟中断或IPI: 当前进程是否需要让出CPU
+int sched_set_nice(int pid, int nice);              // 设置进程的nice值
+int sched_set_rt(int rt_class, uint32 param);       // 设置当前进程的实时调度类
+proc_t *sched_pick();                               // 取出下一个要运行的进程
+void sched_stat();                                  // 输出就绪队列的统计信息
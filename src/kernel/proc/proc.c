@@ -31,6 +31,9 @@ static int next_pid = 1;
 // 进程生命周期锁：用于保护 wait/exit 操作中的进程树关系
 static spinlock_t lifecycle_lock;
 
+// 按睡眠地址散列的等待队列
+static wait_queue_t wait_queues[WAIT_HASH_SIZE];
+
 // --- 内部函数 ---
 
 // 分配一个新的 PID
@@ -43,6 +46,13 @@ static int allocate_pid()
     return pid;
 }
 
+// 睡眠地址对应的等待队列 (乘法散列, 地址的低位通常因为对齐而相同)
+static wait_queue_t *wait_queue_of(void *chan)
+{
+    uint64 h = (uint64)chan * 0x9E3779B97F4A7C15ull;
+    return &wait_queues[h >> (64 - WAIT_HASH_SHIFT)];
+}
+
 // 进程初次运行的入口函数 (内核态 -> 用户态)
 static void proc_entry_point()
 {
@@ -53,6 +63,7 @@ static void proc_entry_point()
     // 必须在这里初始化，因为读取磁盘需要能够 sleep，这依赖于进程上下文
     if (myproc()->pid == 1) {
         fs_init();
+        swap_init(); // 交换区使用文件系统的数据块
     }
 
     // 返回用户空间
@@ -72,19 +83,27 @@ void proc_init()
         // 预先计算好每个进程的内核栈基址
         proc_pool[i].kstack = KSTACK(i);
     }
+    for (int i = 0; i < WAIT_HASH_SIZE; i++) {
+        spinlock_init(&wait_queues[i].lk, "wait_queue");
+        wait_queues[i].head = NULL;
+    }
+    sched_init();
 }
 
 // 初始化进程页表：映射 trampoline 和 trapframe
 pgtbl_t proc_pgtbl_init(uint64 tf_va)
 {
-    pgtbl_t tbl = (pgtbl_t)pmem_alloc(true);
+    pgtbl_t tbl = (pgtbl_t)pmem_alloc(true); // 已清零
     if (!tbl) return NULL;
-    memset(tbl, 0, PGSIZE);
 
     // 映射跳板页 (trampoline) - 执行权限
-    vm_mappages(tbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
     // 映射 trapframe - 读写权限
-    vm_mappages(tbl, TRAPFRAME, tf_va, PGSIZE, PTE_R | PTE_W);
+    // 页表页申请失败时整体销毁 (两者都没有PTE_U, 销毁时不会释放对应的物理页)
+    if (vm_mappages(tbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X) < 0 ||
+        vm_mappages(tbl, TRAPFRAME, tf_va, PGSIZE, PTE_R | PTE_W) < 0) {
+        uvm_destroy_pgtbl(tbl);
+        return NULL;
+    }
 
     return tbl;
 }
@@ -116,7 +135,6 @@ proc_t *proc_alloc()
         spinlock_release(&p->lk);
         return NULL;
     }
-    memset(p->tf, 0, PGSIZE);
 
     // 初始化用户页表
     if ((p->pgtbl = proc_pgtbl_init((uint64)p->tf)) == NULL) {
@@ -138,6 +156,33 @@ proc_t *proc_alloc()
     p->heap_top = 0;
     p->ustack_npage = 0;
     p->mmap = NULL;
+    p->fault_around = FAULT_AROUND_PAGES;
+    p->nr_faults = 0;
+    p->nr_fault_pages = 0;
+    p->nr_fault_around = 0;
+    p->ksm = false;
+    p->kpreempted = false;
+    p->cpu = -1;
+    p->nice = 0;
+    p->weight = NICE_0_WEIGHT;
+    p->vruntime = 0;
+    p->exec_start = 0;
+    p->sum_exec = 0;
+    p->level = 0;
+    p->slice_used = 0;
+    p->boost_epoch = 0;
+    p->rt_class = RT_NONE;
+    p->rt_prio = 0;
+    p->rt_period = 0;
+    p->rt_deadline = 0;
+    p->rt_wake = 0;
+    p->rt_max_latency = 0;
+    p->rt_jobs = 0;
+    p->rt_misses = 0;
+    p->rq_next = NULL;
+    p->wait_next = NULL;
+    p->asid = 0;
+    p->tlb_stale = 0;
     memset(p->name, 0, sizeof(p->name));
 
     return p;
@@ -162,13 +207,9 @@ void proc_free(proc_t *p)
             vm_unmappages(p->pgtbl, TRAPFRAME - p->ustack_npage * PGSIZE, p->ustack_npage * PGSIZE, true);
         
         // 4. 解除 mmap 映射
-        mmap_region_t *m = p->mmap;
-        while (m) {
+        for (mmap_region_t *m = mmap_tree_find(p->mmap, 0); m; m = mmap_tree_find(p->mmap, MMAP_REGION_END(m)))
             vm_unmappages(p->pgtbl, m->begin, m->npages * PGSIZE, true);
-            mmap_region_t *next = m->next;
-            mmap_region_free(m);
-            m = next;
-        }
+        mmap_tree_free(p->mmap);
         p->mmap = NULL;
         
         // 5. 解除系统页映射 (不释放物理内存)
@@ -191,16 +232,21 @@ void proc_free(proc_t *p)
 void proc_make_first()
 {
     proc_t *p = proc_alloc();
+    if (!p) panic("proc_make_first: proc_alloc failed");
     init_process = p;
 
     // 拷贝 initcode 到用户空间
     void *code_mem = pmem_alloc(false);
+    if (!code_mem) panic("proc_make_first: alloc code failed");
     memmove(code_mem, target_user_initcode, target_user_initcode_len);
-    vm_mappages(p->pgtbl, USER_BASE, (uint64)code_mem, PGSIZE, PTE_R|PTE_W|PTE_X|PTE_U);
+    if (vm_mappages(p->pgtbl, USER_BASE, (uint64)code_mem, PGSIZE, PTE_R|PTE_W|PTE_X|PTE_U) < 0)
+        panic("proc_make_first: map code failed");
 
     // 分配并映射用户栈 (1页)
     void *stack_mem = pmem_alloc(false);
-    vm_mappages(p->pgtbl, TRAPFRAME - PGSIZE, (uint64)stack_mem, PGSIZE, PTE_R|PTE_W|PTE_U);
+    if (!stack_mem) panic("proc_make_first: alloc stack failed");
+    if (vm_mappages(p->pgtbl, TRAPFRAME - PGSIZE, (uint64)stack_mem, PGSIZE, PTE_R|PTE_W|PTE_U) < 0)
+        panic("proc_make_first: map stack failed");
     p->ustack_npage = 1;
     p->heap_top = USER_BASE + PGSIZE;
 
@@ -218,6 +264,7 @@ void proc_make_first()
     for(int i=0; s[i]; i++) p->name[i] = s[i];
 
     p->state = RUNNABLE;
+    sched_enqueue(p);
     spinlock_release(&p->lk);
 }
 
@@ -228,22 +275,26 @@ int proc_fork()
     proc_t *child = proc_alloc(); // 返回时持有 child->lk
     if (!child) return -1;
 
-    // 1. 复制地址空间 (页表 + 物理页)
-    uvm_copy_pgtbl(curr->pgtbl, child->pgtbl, curr->heap_top, curr->ustack_npage, curr->mmap);
+    // 1. 复制 mmap 管理结构和堆栈边界
+    // 先于页表复制完成, 这样任何一步失败时 proc_free 都能回收已经拷贝的页面
     child->heap_top = curr->heap_top;
     child->ustack_npage = curr->ustack_npage;
+    child->fault_around = curr->fault_around;
+    child->ksm = curr->ksm;
+    // 子进程继承优先级, 从父进程的虚拟时间开始排队 (不能靠不断fork获得更多CPU)
+    child->nice = curr->nice;
+    child->weight = curr->weight;
+    child->vruntime = curr->vruntime;
+
+    if (mmap_tree_copy(curr->mmap, &child->mmap) < 0) {
+        proc_free(child); // 释放 child->lk
+        return -1;
+    }
 
-    // 2. 复制 mmap 管理结构
-    mmap_region_t *src = curr->mmap;
-    mmap_region_t **dst = &child->mmap;
-    while (src) {
-        mmap_region_t *new_node = mmap_region_alloc();
-        new_node->begin = src->begin;
-        new_node->npages = src->npages;
-        new_node->next = NULL;
-        *dst = new_node;
-        dst = &new_node->next;
-        src = src->next;
+    // 2. 复制地址空间 (页表复制, 物理页写时复制)
+    if (uvm_copy_pgtbl(curr->pgtbl, child->pgtbl, curr->heap_top, curr->ustack_npage, curr->mmap) < 0) {
+        proc_free(child); // 释放 child->lk
+        return -1;
     }
 
     // 3. 复制 Trapframe
@@ -259,6 +310,7 @@ int proc_fork()
     
     int pid = child->pid;
     child->state = RUNNABLE;
+    sched_enqueue(child);
     spinlock_release(&child->lk);
     
     return pid; // 父进程返回子进程 PID
@@ -276,6 +328,8 @@ void proc_yield()
     proc_t *p = myproc();
     spinlock_acquire(&p->lk);
     p->state = RUNNABLE;
+    sched_charge(p);
+    sched_enqueue(p);
     proc_sched();
     spinlock_release(&p->lk);
 }
@@ -284,15 +338,35 @@ void proc_yield()
 // 唤醒所有在 chan 上等待的进程
 void proc_wakeup(void *chan)
 {
-    for (int i = 0; i < N_PROC; i++) {
-        proc_t *p = &proc_pool[i];
-        if (p != myproc()) {
-            spinlock_acquire(&p->lk);
-            if (p->state == SLEEPING && p->sleep_space == chan) {
-                p->state = RUNNABLE;
-            }
-            spinlock_release(&p->lk);
+    wait_queue_t *wq = wait_queue_of(chan);
+    proc_t *woken = NULL;
+
+    // 摘下所有等待 chan 的进程 (同一队列中可能还有散列冲突的其他地址)
+    spinlock_acquire(&wq->lk);
+    proc_t **link = &wq->head;
+    while (*link != NULL) {
+        proc_t *p = *link;
+        if (p->sleep_space == chan) {
+            *link = p->wait_next;
+            p->wait_next = woken;
+            woken = p;
+        } else {
+            link = &p->wait_next;
+        }
+    }
+    spinlock_release(&wq->lk);
+
+    // 获取 p->lk 时进程已经完成切换, 唤醒前先取出链表的下一个节点
+    while (woken != NULL) {
+        proc_t *p = woken;
+        woken = p->wait_next;
+        spinlock_acquire(&p->lk);
+        p->wait_next = NULL;
+        if (p->state == SLEEPING && p->sleep_space == chan) {
+            p->state = RUNNABLE;
+            sched_wakeup(p);
         }
+        spinlock_release(&p->lk);
     }
 }
 
@@ -301,15 +375,25 @@ void proc_wakeup(void *chan)
 void proc_sleep(void *chan, spinlock_t *lk)
 {
     proc_t *p = myproc();
+    wait_queue_t *wq = wait_queue_of(chan);
     
     // 必须持有进程锁才能修改状态和切换
-    // 为了避免死锁，先获取进程锁，再释放传入的外部锁
+    // 先获取进程锁并挂入等待队列, 之后才能释放传入的外部锁 (锁的顺序: lk -> p->lk -> wait_queue.lk)
+    // 否则释放 lk 之后、入队之前发生的唤醒找不到本进程, 唤醒就丢失了
     spinlock_acquire(&p->lk);
-    spinlock_release(lk);
-
     p->sleep_space = chan;
     p->state = SLEEPING;
 
+    // 唤醒者在队列中找到本进程后还需要 p->lk, 在切换完成之前不会修改本进程的状态
+    spinlock_acquire(&wq->lk);
+    p->wait_next = wq->head;
+    wq->head = p;
+    spinlock_release(&wq->lk);
+
+    spinlock_release(lk);
+
+    sched_charge(p);
+    sched_block(p);
     proc_sched(); // 切换 CPU
 
     // 醒来后清理
@@ -320,6 +404,90 @@ void proc_sleep(void *chan, spinlock_t *lk)
     spinlock_acquire(lk);
 }
 
+#ifdef WAKE_BENCH
+// 微基准测试用的假睡眠者: 只挂在等待队列上, 不会被调度
+static proc_t bench_sleepers[N_PROC];
+
+// 辅助函数: 从 base 之后按8字节步长寻找第 n 个与 chan 是否同一队列(same)相符的地址
+static void *wake_bench_chan(void *chan, bool same, int n)
+{
+    wait_queue_t *wq = wait_queue_of(chan);
+    uint64 addr = (uint64)chan;
+    for (;;) {
+        addr += sizeof(uint64);
+        if ((wait_queue_of((void *)addr) == wq) == same && n-- == 0)
+            return (void *)addr;
+    }
+}
+
+/*
+ * 辅助函数: 在等待队列中挂入 n 个假睡眠者后唤醒 chan 若干次, 返回每次唤醒的平均周期数
+ * same 为 true 时假睡眠者等待与 chan 散列冲突的其他地址, 否则等待其他队列中的地址
+ * 测试只在启动阶段运行, 结束后按入队的相反顺序摘下假睡眠者
+ */
+static uint64 wake_bench_run(void *chan, bool same, int n)
+{
+    const int rounds = 1024;
+
+    for (int i = 0; i < n; i++) {
+        proc_t *p = &bench_sleepers[i];
+        wait_queue_t *wq;
+        p->sleep_space = wake_bench_chan(chan, same, i);
+        p->state = SLEEPING;
+        wq = wait_queue_of(p->sleep_space);
+        spinlock_acquire(&wq->lk);
+        p->wait_next = wq->head;
+        wq->head = p;
+        spinlock_release(&wq->lk);
+    }
+
+    uint64 begin = r_cycle();
+    for (int i = 0; i < rounds; i++)
+        proc_wakeup(chan);
+    uint64 cycles = r_cycle() - begin;
+
+    for (int i = n - 1; i >= 0; i--) {
+        proc_t *p = &bench_sleepers[i];
+        wait_queue_t *wq = wait_queue_of(p->sleep_space);
+        spinlock_acquire(&wq->lk);
+        if (wq->head != p)
+            panic("wake_bench: wait queue corrupted");
+        wq->head = p->wait_next;
+        spinlock_release(&wq->lk);
+        p->wait_next = NULL;
+        p->sleep_space = NULL;
+        p->state = UNUSED;
+    }
+    return cycles / rounds;
+}
+
+/*
+ * 微基准测试: proc_wakeup 的平均开销 (make WAKEBENCH=1)
+ * 分别让不同数量的睡眠者等待同一队列中的其他地址和其他队列中的地址:
+ * 前者的开销随冲突的睡眠者数量线性增长, 后者应当与睡眠者数量无关
+ */
+void proc_wake_bench()
+{
+    static int chan;
+    const int counts[] = {0, 1, 4, 16, N_PROC};
+
+    for (int i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        int n = counts[i];
+        printf("wake_bench: %d sleepers, same bucket %d cycles/wakeup, other buckets %d cycles/wakeup\n",
+               n, (int)wake_bench_run(&chan, true, n), (int)wake_bench_run(&chan, false, n));
+    }
+    printf("wake_bench: N_PROC=%d, WAIT_HASH_SIZE=%d\n", N_PROC, WAIT_HASH_SIZE);
+}
+#endif
+
+// 按下标获取进程池中的进程 (供需要遍历所有进程的模块使用, 如KSM扫描)
+proc_t *proc_get(int idx)
+{
+    if (idx < 0 || idx >= N_PROC)
+        return NULL;
+    return &proc_pool[idx];
+}
+
 // 调度器主循环
 void proc_scheduler()
 {
@@ -330,28 +498,33 @@ void proc_scheduler()
         // 开启中断，避免调度器空转时无法响应中断
         intr_on();
 
-        for (int i = 0; i < N_PROC; i++) {
-            proc_t *p = &proc_pool[i];
-            
-            spinlock_acquire(&p->lk);
-            
-            if (p->state == RUNNABLE) {
-                p->state = RUNNING;
-                c->proc = p;
-                
-                // [DEBUG] 仅在开启追踪时打印，避免 Test-1 刷屏
-                #if SCHED_TRACE
-                printf("proc %d is running...\n", p->pid);
-                #endif
-                
-                swtch(&c->ctx, &p->ctx);
-                
-                // 进程切换回来，清理 CPU 引用
-                c->proc = NULL;
-            }
-            
-            spinlock_release(&p->lk);
+        // 从就绪队列取出下一个进程, 没有可运行的进程时利用空闲时间预先清零物理页并合并相同页面
+        proc_t *p = sched_pick();
+        if (p == NULL) {
+            pmem_idle_zero();
+            ksm_scan();
+            continue;
         }
+
+        // 让出CPU的进程在切换回调度器之前就已入队, 获取 p->lk 保证它的上下文已经保存
+        spinlock_acquire(&p->lk);
+        if (p->state == RUNNABLE) {
+            p->state = RUNNING;
+            p->cpu = mycpuid();
+            sched_start(p);
+            c->proc = p;
+
+            // [DEBUG] 仅在开启追踪时打印，避免 Test-1 刷屏
+            #if SCHED_TRACE
+            printf("proc %d is running...\n", p->pid);
+            #endif
+
+            swtch(&c->ctx, &p->ctx);
+
+            // 进程切换回来，清理 CPU 引用
+            c->proc = NULL;
+        }
+        spinlock_release(&p->lk);
     }
 }
 
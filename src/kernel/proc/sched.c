@@ -0,0 +1,418 @@
+#include "mod.h"
+#include "../arch/mod.h"
+
+// 每个CPU的就绪队列
+static runqueue_t runqueues[NCPU];
+
+// nice值到权重的换算表 (相邻两级约相差1.25倍, nice 0 对应 NICE_0_WEIGHT)
+static const uint32 nice_to_weight[NICE_MAX - NICE_MIN + 1] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */ 9548, 7620, 6100, 4904, 3906,
+    /*  -5 */ 3121, 2501, 1991, 1586, 1277,
+    /*   0 */ 1024, 820, 655, 526, 423,
+    /*   5 */ 335, 272, 215, 172, 137,
+    /*  10 */ 110, 87, 70, 56, 45,
+    /*  15 */ 36, 29, 23, 18, 15,
+};
+
+void sched_init()
+{
+    for (int i = 0; i < NCPU; i++) {
+        spinlock_init(&runqueues[i].lk, "runqueue");
+        runqueues[i].head = NULL;
+        runqueues[i].tail = NULL;
+        runqueues[i].nr = 0;
+        runqueues[i].min_vruntime = 0;
+        runqueues[i].nr_steal = 0;
+        runqueues[i].rt_head = NULL;
+        runqueues[i].nr_rt = 0;
+        runqueues[i].nr_ipi = 0;
+    }
+}
+
+// 结算进程 p 从 exec_start 到现在的运行时间 (调用者持有 p->lk)
+void sched_charge(proc_t *p)
+{
+    uint64 now = r_time();
+    uint64 delta = now - p->exec_start;
+    p->exec_start = now;
+    p->sum_exec += delta;
+    p->vruntime += delta * NICE_0_WEIGHT / p->weight;
+}
+
+// 调度类的先后: 截止时间类 > FIFO类 > 普通进程
+static int rt_rank(proc_t *p)
+{
+    if (p->rt_class == RT_DEADLINE)
+        return 0;
+    if (p->rt_class == RT_FIFO)
+        return 1;
+    return 2;
+}
+
+// 实时进程 a 是否应该先于(可以抢占) b 运行
+static bool rt_before(proc_t *a, proc_t *b)
+{
+    if (rt_rank(a) != rt_rank(b))
+        return rt_rank(a) < rt_rank(b);
+    if (a->rt_class == RT_DEADLINE)
+        return a->rt_deadline < b->rt_deadline;
+    if (a->rt_class == RT_FIFO)
+        return a->rt_prio > b->rt_prio;
+    return false;
+}
+
+#if SCHED_POLICY == SCHED_MLFQ
+// 当前的提升周期编号 (每 MLFQ_BOOST_TICKS 个tick加一)
+static uint64 mlfq_epoch()
+{
+    return r_time() / ((uint64)MLFQ_BOOST_TICKS * INTERVAL);
+}
+
+// 进程的提升周期过期时完成惰性提升: 回到 level 0 并重新计算时间片 (调用者持有 p->lk)
+static void mlfq_refresh(proc_t *p, uint64 epoch)
+{
+    if (p->boost_epoch < epoch) {
+        p->boost_epoch = epoch;
+        p->level = 0;
+        p->slice_used = 0;
+    }
+}
+#endif
+
+/*
+ * 调度策略决定的排序键, 越小越先运行
+ * epoch 是调用者取得的提升周期编号 (只用于MLFQ), 一次队列操作中保持不变, 保证键值前后一致
+ */
+static uint64 sched_key(proc_t *p, uint64 epoch)
+{
+#if SCHED_POLICY == SCHED_CFS
+    return p->vruntime;
+#elif SCHED_POLICY == SCHED_MLFQ
+    // 周期过期的进程已经被提升, 入队时间早于新周期的进程全部变为0, 队列仍然有序
+    return (p->boost_epoch >= epoch) ? p->level : 0;
+#else
+    return 0;
+#endif
+}
+
+// 把刚变为 RUNNABLE 的进程 p 按排序键插入队列, 相同时排在后面 (调用者持有 p->lk)
+void sched_enqueue(proc_t *p)
+{
+    int cpu = (p->cpu >= 0 && p->cpu < NCPU) ? p->cpu : mycpuid();
+    runqueue_t *rq = &runqueues[cpu];
+
+    spinlock_acquire(&rq->lk);
+    if (p->rt_class != RT_NONE) {
+        proc_t **link = &rq->rt_head;
+        while (*link != NULL && !rt_before(p, *link))
+            link = &(*link)->rq_next;
+        p->rq_next = *link;
+        *link = p;
+        rq->nr_rt++;
+        spinlock_release(&rq->lk);
+        return;
+    }
+
+    uint64 epoch = 0;
+#if SCHED_POLICY == SCHED_CFS
+    if (rq->min_vruntime > SCHED_WAKEUP_BONUS)
+        p->vruntime = MAX(p->vruntime, rq->min_vruntime - SCHED_WAKEUP_BONUS);
+#elif SCHED_POLICY == SCHED_MLFQ
+    epoch = mlfq_epoch();
+    mlfq_refresh(p, epoch);
+#endif
+
+    // 不小于队尾的键值直接追加到队尾 (轮转策略总是如此), 否则从队头查找插入位置
+    uint64 key = sched_key(p, epoch);
+    if (rq->tail == NULL || sched_key(rq->tail, epoch) <= key) {
+        p->rq_next = NULL;
+        if (rq->tail == NULL)
+            rq->head = p;
+        else
+            rq->tail->rq_next = p;
+        rq->tail = p;
+    } else {
+        proc_t **link = &rq->head;
+        while (sched_key(*link, epoch) <= key)
+            link = &(*link)->rq_next;
+        p->rq_next = *link;
+        *link = p;
+    }
+    rq->nr++;
+    spinlock_release(&rq->lk);
+}
+
+// 为醒来的实时进程挑选CPU: 依次检查上次运行的CPU和其他CPU, 选择空闲或者可以被它抢占的CPU
+static int rt_select_cpu(proc_t *p)
+{
+    int first = (p->cpu >= 0 && p->cpu < NCPU) ? p->cpu : mycpuid();
+    for (int i = 0; i < NCPU; i++) {
+        int cpu = (first + i) % NCPU;
+        proc_t *curr = cpu_get(cpu)->proc; // 不加锁读取, 只是提示
+        if (curr == NULL || rt_before(p, curr))
+            return cpu;
+    }
+    return first;
+}
+
+// 目标CPU正在运行优先级更低的进程时发送IPI, 让它立即进入调度
+static void rt_kick(int cpu, proc_t *p)
+{
+    proc_t *curr = cpu_get(cpu)->proc;
+    if (curr == NULL || !rt_before(p, curr))
+        return;
+    __atomic_fetch_add(&runqueues[cpu].nr_ipi, 1, __ATOMIC_RELAXED);
+    ipi_send(cpu);
+}
+
+// 睡眠结束的进程 p 重新就绪 (调用者持有 p->lk)
+void sched_wakeup(proc_t *p)
+{
+    // 实时进程: 开始一个新作业, 放到可以马上运行它的CPU上
+    if (p->rt_class != RT_NONE) {
+        uint64 now = r_time();
+        p->rt_wake = now;
+        p->rt_jobs++;
+        if (p->rt_class == RT_DEADLINE)
+            p->rt_deadline = now + p->rt_period;
+        p->cpu = rt_select_cpu(p);
+        sched_enqueue(p);
+        rt_kick(p->cpu, p);
+        return;
+    }
+
+#if SCHED_POLICY == SCHED_MLFQ
+    // 时间片用完之前就去睡眠的进程提升一级, 并重新开始计算时间片
+    mlfq_refresh(p, mlfq_epoch());
+    if (p->level > 0)
+        p->level--;
+    p->slice_used = 0;
+#endif
+    sched_enqueue(p);
+}
+
+// 进程即将睡眠, 当前作业结束: 检查截止时间 (调用者持有 p->lk)
+void sched_block(proc_t *p)
+{
+    if (p->rt_class == RT_DEADLINE && r_time() > p->rt_deadline)
+        p->rt_misses++;
+}
+
+// 调度器即将运行进程 p: 开始计时, 记录实时进程的唤醒延迟 (调用者持有 p->lk)
+void sched_start(proc_t *p)
+{
+    p->exec_start = r_time();
+    if (p->rt_wake != 0) {
+        p->rt_max_latency = MAX(p->rt_max_latency, p->exec_start - p->rt_wake);
+        p->rt_wake = 0;
+    }
+}
+
+/*
+ * 时钟中断或者其他CPU发来的IPI时由当前CPU调用 (myproc() 正在运行), 返回当前进程是否需要让出CPU
+ * tick 表示是否经过了一个时钟tick (IPI只用于实时进程的抢占)
+ * 本CPU的实时队列中有更高优先级的进程时立即让出; 实时进程不因时钟tick让出
+ * 普通进程: 轮转和加权公平调度每个tick都让出; MLFQ只在时间片用完或者有更高优先级的进程等待时让出
+ */
+bool sched_tick(bool tick)
+{
+    proc_t *p = myproc();
+    runqueue_t *rq = &runqueues[mycpuid()];
+
+    spinlock_acquire(&rq->lk);
+    bool rt_preempt = (rq->rt_head != NULL && rt_before(rq->rt_head, p));
+    spinlock_release(&rq->lk);
+    if (rt_preempt || p->rt_class != RT_NONE || !tick)
+        return rt_preempt;
+
+#if SCHED_POLICY == SCHED_MLFQ
+    uint64 epoch = mlfq_epoch();
+    spinlock_acquire(&p->lk);
+    mlfq_refresh(p, epoch);
+    bool expired = (++p->slice_used >= MLFQ_SLICE(p->level));
+    if (expired) {
+        if (p->level < MLFQ_LEVELS - 1)
+            p->level++;
+        p->slice_used = 0;
+    }
+    int level = p->level;
+    spinlock_release(&p->lk);
+
+    // 等待中的进程由 sched_key 按周期编号惰性提升, 这里不修改它们 (没有持有它们的 p->lk)
+    spinlock_acquire(&rq->lk);
+    bool preempt = (rq->head != NULL && sched_key(rq->head, epoch) < level);
+    spinlock_release(&rq->lk);
+
+    return expired || preempt;
+#else
+    return true;
+#endif
+}
+
+/*
+ * 取出实时队列(rt为true)或普通队列的队头, 队列为空时返回NULL
+ * 加权公平调度时普通队列同时推进 min_vruntime
+ */
+static proc_t *rq_pop(runqueue_t *rq, bool steal, bool rt)
+{
+    spinlock_acquire(&rq->lk);
+    proc_t *p = rt ? rq->rt_head : rq->head;
+    if (p != NULL && rt) {
+        rq->rt_head = p->rq_next;
+        rq->nr_rt--;
+    } else if (p != NULL) {
+        rq->head = p->rq_next;
+        if (rq->head == NULL)
+            rq->tail = NULL;
+        rq->nr--;
+#if SCHED_POLICY == SCHED_CFS
+        // 在队列中的进程只有持有 rq->lk 才能修改 vruntime (sched_enqueue), 这里可以直接读取
+        rq->min_vruntime = MAX(rq->min_vruntime, p->vruntime);
+#endif
+    }
+    if (p != NULL)
+        p->rq_next = NULL;
+    spinlock_release(&rq->lk);
+
+    if (p == NULL || !steal)
+        return p;
+
+    runqueue_t *self = &runqueues[mycpuid()];
+    spinlock_acquire(&self->lk);
+    self->nr_steal++;
+#if SCHED_POLICY == SCHED_CFS
+    uint64 base = self->min_vruntime;
+#endif
+    spinlock_release(&self->lk);
+
+#if SCHED_POLICY == SCHED_CFS
+    // 各队列的虚拟时间基准不同, 偷来的普通进程从本队列的基准开始计算
+    // 进程已经离开队列, 它的 vruntime 由 p->lk 保护 (不持有队列锁, 符合 p->lk -> rq->lk 的顺序)
+    if (!rt) {
+        spinlock_acquire(&p->lk);
+        p->vruntime = base;
+        spinlock_release(&p->lk);
+    }
+#endif
+    return p;
+}
+
+// 从队列最长的其他CPU偷取一个实时(rt为true)或普通进程, 没有时返回NULL
+static proc_t *rq_steal(int self, bool rt)
+{
+    // 不加锁读取队列长度只用于挑选偷取对象, 真正取出时再加锁
+    int victim = -1;
+    uint32 most = 0;
+    for (int i = 0; i < NCPU; i++) {
+        uint32 nr = __atomic_load_n(rt ? &runqueues[i].nr_rt : &runqueues[i].nr, __ATOMIC_RELAXED);
+        if (i != self && nr > most) {
+            most = nr;
+            victim = i;
+        }
+    }
+    if (victim < 0)
+        return NULL;
+    return rq_pop(&runqueues[victim], true, rt);
+}
+
+/*
+ * 调度器选择下一个要运行的进程, 依次尝试: 本CPU的实时队列, 其他CPU的实时队列,
+ * 本CPU的普通队列, 其他CPU的普通队列 (偷取最长的队列), 都为空时返回NULL
+ * 返回的进程已经离开队列, 调度器获取 p->lk 后运行它
+ */
+proc_t *sched_pick()
+{
+    int self = mycpuid();
+    proc_t *p = rq_pop(&runqueues[self], false, true);
+    if (p == NULL)
+        p = rq_steal(self, true);
+    if (p == NULL)
+        p = rq_pop(&runqueues[self], false, false);
+    if (p == NULL)
+        p = rq_steal(self, false);
+    return p;
+}
+
+/*
+ * 设置进程的nice值 (pid为0表示当前进程), 新的权重从下一次结算开始生效
+ * 成功返回0, nice越界或者进程不存在返回-1
+ */
+int sched_set_nice(int pid, int nice)
+{
+    if (nice < NICE_MIN || nice > NICE_MAX)
+        return -1;
+    if (pid == 0)
+        pid = myproc()->pid;
+
+    for (int i = 0; i < N_PROC; i++) {
+        proc_t *p = proc_get(i);
+        spinlock_acquire(&p->lk);
+        if (p->state != UNUSED && p->state != ZOMBIE && p->pid == pid) {
+            // 正在运行的进程先按旧权重结算已经运行的时间
+            if (p == myproc())
+                sched_charge(p);
+            p->nice = nice;
+            p->weight = nice_to_weight[nice - NICE_MIN];
+            spinlock_release(&p->lk);
+            return 0;
+        }
+        spinlock_release(&p->lk);
+    }
+    return -1;
+}
+
+/*
+ * 设置当前进程的实时调度类: RT_NONE 恢复为普通进程,
+ * RT_FIFO 的 param 为优先级 (RT_PRIO_MIN ~ RT_PRIO_MAX), RT_DEADLINE 的 param 为周期 (tick)
+ * 成功返回0, 参数非法返回-1; 统计信息随之清零
+ */
+int sched_set_rt(int rt_class, uint32 param)
+{
+    if (rt_class == RT_FIFO && (param < RT_PRIO_MIN || param > RT_PRIO_MAX))
+        return -1;
+    if (rt_class == RT_DEADLINE && param == 0)
+        return -1;
+    if (rt_class != RT_NONE && rt_class != RT_FIFO && rt_class != RT_DEADLINE)
+        return -1;
+
+    // 正在运行的进程不在任何就绪队列中, 可以直接修改调度类
+    proc_t *p = myproc();
+    spinlock_acquire(&p->lk);
+    p->rt_class = rt_class;
+    p->rt_prio = (rt_class == RT_FIFO) ? param : 0;
+    p->rt_period = (rt_class == RT_DEADLINE) ? (uint64)param * INTERVAL : 0;
+    p->rt_deadline = r_time() + p->rt_period;
+    p->rt_wake = 0;
+    p->rt_max_latency = 0;
+    p->rt_jobs = 0;
+    p->rt_misses = 0;
+    spinlock_release(&p->lk);
+    return 0;
+}
+
+// 输出各CPU就绪队列的长度、偷取和IPI次数, 以及各进程的调度参数、累计运行时间和实时统计
+void sched_stat()
+{
+    printf("\n=== Run Queues (policy %d) ===\n", SCHED_POLICY);
+    for (int i = 0; i < NCPU; i++) {
+        spinlock_acquire(&runqueues[i].lk);
+        printf("cpu %d: runnable %d, real-time %d, stolen %d, ipi %d, min_vruntime %d\n", i,
+               runqueues[i].nr, runqueues[i].nr_rt, (int)runqueues[i].nr_steal,
+               (int)runqueues[i].nr_ipi, (int)runqueues[i].min_vruntime);
+        spinlock_release(&runqueues[i].lk);
+    }
+    for (int i = 0; i < N_PROC; i++) {
+        proc_t *p = proc_get(i);
+        spinlock_acquire(&p->lk);
+        if (p->state != UNUSED)
+            printf("pid %d: nice %d, weight %d, vruntime %d, level %d, runtime %d\n", p->pid, p->nice,
+                   p->weight, (int)p->vruntime, p->level, (int)p->sum_exec);
+        if (p->state != UNUSED && p->rt_class != RT_NONE)
+            printf("    rt class %d, prio %d, period %d, jobs %d, deadline misses %d, max latency %d\n",
+                   p->rt_class, p->rt_prio, (int)p->rt_period, (int)p->rt_jobs, (int)p->rt_misses,
+                   (int)p->rt_max_latency);
+        spinlock_release(&p->lk);
+    }
+}
@@ -102,9 +102,36 @@ typedef struct proc
     void *sleep_space;     // 进程睡眠位置(等待的资源)
 
     pgtbl_t pgtbl;       // 用户态页表
+    uint64 asid;         // 地址空间标识符 (代号 + ASID), 0表示尚未分配
+    uint32 tlb_stale;    // 需要先刷新该ASID才能运行本进程的CPU集合 (bitmap)
     uint64 heap_top;     // 用户堆顶(以字节为单位)
     uint64 ustack_npage; // 用户栈占用的页面数量
-    mmap_region_t *mmap; // 用户态mmap区域
+    mmap_region_t *mmap; // 用户态mmap区域 (平衡树的根)
+    uint32 fault_around;      // 缺页预取窗口 (页数)
+    uint64 nr_faults;         // 处理过的缺页次数
+    uint64 nr_fault_pages;    // 缺页处理映射的页面数
+    uint64 nr_fault_around;   // 其中由预取映射的页面数 (最多节省这么多次缺页)
+    bool ksm;                 // 是否允许合并相同页面 (KSM)
+    bool kpreempted;          // 是否在内核态被抢占 (此时不能修改它的页表)
+    int cpu;                  // 上次运行所在的CPU (-1表示还没有运行过), 就绪时进入该CPU的队列
+    int nice;                 // 友好值 (NICE_MIN ~ NICE_MAX, 越小越重要)
+    uint32 weight;            // 由nice换算的权重
+    uint64 vruntime;          // 虚拟运行时间 (按权重折算后的运行时间)
+    uint64 exec_start;        // 本次开始计时的时间 (r_time)
+    uint64 sum_exec;          // 累计运行时间 (r_time)
+    int level;                // MLFQ优先级 (0最高)
+    uint32 slice_used;        // MLFQ当前时间片已经用掉的tick数
+    uint64 boost_epoch;       // MLFQ: level 和 slice_used 所属的提升周期编号
+    int rt_class;             // 实时调度类 (RT_NONE表示普通进程)
+    int rt_prio;              // RT_FIFO的优先级 (越大越优先)
+    uint64 rt_period;         // RT_DEADLINE的周期, 也是相对截止时间 (r_time)
+    uint64 rt_deadline;       // RT_DEADLINE当前作业的绝对截止时间 (r_time)
+    uint64 rt_wake;           // 最近一次被唤醒的时间 (r_time, 0表示已经开始运行)
+    uint64 rt_max_latency;    // 从唤醒到开始运行的最大延迟 (r_time)
+    uint64 rt_jobs;           // 作业数 (被唤醒的次数)
+    uint64 rt_misses;         // 错过截止时间的作业数
+    struct proc *rq_next;     // 就绪队列中的下一个进程
+    struct proc *wait_next;   // 等待队列中的下一个进程
     trapframe_t *tf;     // 用户态内核态切换时的运行环境暂存空间
 
     uint64 kstack;       // 内核栈的虚拟地址
@@ -113,3 +140,91 @@ typedef struct proc
 
 // 系统中最多同时存在N_PROC个进程
 #define N_PROC 32
+
+/*
+    每个CPU一个就绪队列, 按调度策略给出的排序键从小到大排列, 排序键相同的进程先进先出:
+    - 进程变为 RUNNABLE 时(创建、fork、唤醒、让出CPU)由 sched_enqueue 放入上次运行所在CPU的队列,
+      还没有运行过的进程放入当前CPU的队列
+    - 调度器先取本CPU队列的队头, 本地为空时从最长的其他队列偷取一个进程 (work stealing)
+    - 时钟中断时由 sched_tick 决定当前进程是否让出CPU
+    - 锁的顺序: p->lk -> runqueue.lk; 调度器取出进程时只持有 runqueue.lk, 释放后再获取 p->lk
+
+    调度策略在编译时选择 (make SCHED=rr/cfs/mlfq):
+    SCHED_RR   轮转: 排序键恒为0, 每个tick让出CPU, 排到队尾
+    SCHED_CFS  加权公平 (类似CFS, 默认): 排序键为虚拟运行时间(vruntime)
+      - 进程停止运行时 vruntime 增加 实际运行时间 * NICE_0_WEIGHT / weight, 权重越大增长越慢, 得到的CPU时间越多
+      - 每个tick让出一次CPU, 重新按 vruntime 排队
+      - 醒来的进程 vruntime 至少为 min_vruntime - SCHED_WAKEUP_BONUS:
+        只补偿一点等待时间, 避免长时间睡眠的进程醒来后长期独占CPU
+    SCHED_MLFQ 多级反馈队列: 排序键为优先级 level (0最高)
+      - 新进程从 level 0 开始, level 的时间片为 MLFQ_SLICE(level) 个tick
+      - 用完整个时间片的进程降一级 (CPU密集型进程逐渐沉到底层)
+      - 睡眠后被唤醒的进程升一级 (等待I/O和时钟的进程保持高优先级, 醒来后尽快运行)
+      - 队列中出现更高优先级的进程时, 当前进程在下一个tick让出CPU
+      - 每 MLFQ_BOOST_TICKS 个tick把所有进程提升到 level 0, 防止饥饿
+        提升是惰性的: 时间按 MLFQ_BOOST_TICKS 划分为提升周期, 进程记录的周期编号过期时视为 level 0,
+        下一次在 p->lk 保护下被唤醒、入队或者结算tick时才真正重置 level 和 slice_used
+*/
+#define SCHED_RR 0
+#define SCHED_CFS 1
+#define SCHED_MLFQ 2
+
+#ifndef SCHED_POLICY
+#define SCHED_POLICY SCHED_CFS
+#endif
+
+/*
+    实时调度类 (与上面的调度策略无关, 总是先于普通进程运行):
+    - 每个CPU的就绪队列另有一条实时队列: RT_DEADLINE 先于 RT_FIFO,
+      RT_DEADLINE 按截止时间先后排列(EDF), RT_FIFO 按优先级排列, 相同时先进先出
+    - 实时进程不因时钟tick让出CPU, 只被更高优先级的实时进程抢占, 或者自己睡眠
+    - 实时进程被唤醒时选择空闲或者正在运行更低优先级进程的CPU入队,
+      并通过CLINT向该CPU发送软件中断(IPI), 对方立即让出CPU, 不必等到下一个tick
+    - RT_DEADLINE 进程每次被唤醒开始一个新作业, 截止时间为 唤醒时间 + 周期;
+      作业结束(再次睡眠)时已经超过截止时间则记为一次错过
+    - 只能设置当前进程自己的调度类; fork出的子进程是普通进程
+    - 实时进程可以让同一CPU上的普通进程饿死 (空闲CPU仍会偷取这些普通进程)
+*/
+#define RT_NONE 0     // 普通进程
+#define RT_FIFO 1     // 固定优先级, 先进先出
+#define RT_DEADLINE 2 // 最早截止时间优先
+#define RT_PRIO_MIN 1
+#define RT_PRIO_MAX 99
+
+#define MLFQ_LEVELS 3                     // 优先级数量
+#define MLFQ_SLICE(level) (1u << (level)) // 各级的时间片 (tick): 1, 2, 4
+#define MLFQ_BOOST_TICKS 50               // 全体提升的周期 (tick)
+
+#define NICE_MIN (-20)
+#define NICE_MAX 19
+#define NICE_0_WEIGHT 1024            // nice为0的权重
+#define SCHED_WAKEUP_BONUS INTERVAL   // 醒来的进程最多领先 min_vruntime 一个tick
+typedef struct runqueue
+{
+    spinlock_t lk;      // 保护以下字段
+    struct proc *head;  // 队头 (下一个运行)
+    struct proc *tail;  // 队尾
+    uint32 nr;          // 队列长度
+    uint64 min_vruntime; // 队列的虚拟时间基准 (单调增长, 只在加权公平调度时维护)
+    uint64 nr_steal;    // 从其他CPU偷取的进程数
+    struct proc *rt_head; // 实时队列 (优先级从高到低)
+    uint32 nr_rt;       // 实时队列长度
+    uint64 nr_ipi;      // 为抢占本CPU而收到的IPI次数
+} runqueue_t;
+
+/*
+    睡眠的进程按等待的地址(sleep_space)散列到 WAIT_HASH_SIZE 个等待队列中,
+    proc_wakeup 只检查对应队列中的进程, 开销与系统中的进程数无关
+    - proc_sleep 持有调用者的锁和 p->lk 时把自己挂入队列, 然后才释放调用者的锁,
+      直到调度器释放 p->lk 之后才能被唤醒 (锁的顺序: lk -> p->lk -> wait_queue.lk)
+    - proc_wakeup 先在队列锁内摘下所有等待该地址的进程, 释放队列锁后再逐个获取 p->lk 唤醒
+      (调用者通常持有同一个 lk, 所以不会错过已经入队但还没有切换的进程)
+*/
+#define WAIT_HASH_SHIFT 6
+#define WAIT_HASH_SIZE (1 << WAIT_HASH_SHIFT)
+
+typedef struct wait_queue
+{
+    spinlock_t lk;      // 保护队列
+    struct proc *head;  // 等待队列 (单向, 通过 wait_next 链接)
+} wait_queue_t;
@@ -26,4 +26,16 @@ uint64 sys_put_block();
 uint64 sys_read_block();
 uint64 sys_write_block();
 uint64 sys_show_buffer();
-uint64 sys_flush_buffer();
\ No newline at end of file
+uint64 sys_flush_buffer();
+uint64 sys_show_pmem();
+uint64 sys_fault_around();
+uint64 sys_show_fault();
+uint64 sys_shm_create();
+uint64 sys_shm_map();
+uint64 sys_shm_destroy();
+uint64 sys_ksm();
+uint64 sys_show_ksm();
+uint64 sys_show_swap();
+uint64 sys_show_sched();
+uint64 sys_setnice();
+uint64 sys_sched_rt();
\ No newline at end of file
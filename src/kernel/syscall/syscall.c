@@ -23,6 +23,18 @@ static uint64 (*syscalls[])(void) = {
     [SYS_put_block] sys_put_block,
     [SYS_show_buffer] sys_show_buffer,
     [SYS_flush_buffer] sys_flush_buffer,
+    [SYS_show_pmem] sys_show_pmem,
+    [SYS_fault_around] sys_fault_around,
+    [SYS_show_fault] sys_show_fault,
+    [SYS_shm_create] sys_shm_create,
+    [SYS_shm_map] sys_shm_map,
+    [SYS_shm_destroy] sys_shm_destroy,
+    [SYS_ksm] sys_ksm,
+    [SYS_show_ksm] sys_show_ksm,
+    [SYS_show_swap] sys_show_swap,
+    [SYS_show_sched] sys_show_sched,
+    [SYS_setnice] sys_setnice,
+    [SYS_sched_rt] sys_sched_rt,
 };
 
 // 基于系统调用表的请求跳转
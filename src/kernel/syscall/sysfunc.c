@@ -4,6 +4,7 @@
  * 系统调用：调整堆大小 (sys_brk)
  * 参数：
  * target_brk: 新的堆顶地址。如果为 0，则仅返回当前堆顶。
+ * flags: MAP_POPULATE 表示堆增长时立即分配新增的页面, 否则访问时才分配。
  * 返回值：
  * 成功返回新的堆顶地址，失败返回 -1
  */
@@ -11,9 +12,11 @@ uint64 sys_brk()
 {
     proc_t *cur_proc = myproc();
     uint64 target_brk;
+    uint32 flags;
     uint64 current_brk = cur_proc->heap_top;
 
     arg_uint64(0, &target_brk);
+    arg_uint32(1, &flags);
 
     if (target_brk == 0 || target_brk == current_brk)
         return current_brk;
@@ -21,7 +24,7 @@ uint64 sys_brk()
     if (target_brk > current_brk) {
         // 堆增长
         uint32 grow_size = (uint32)(target_brk - current_brk);
-        uint64 new_addr = uvm_heap_grow(cur_proc->pgtbl, current_brk, grow_size);
+        uint64 new_addr = uvm_heap_grow(cur_proc->pgtbl, current_brk, grow_size, (flags & MAP_POPULATE) != 0);
         
         if (new_addr == (uint64)-1)
             return (uint64)-1;
@@ -46,15 +49,17 @@ uint64 sys_brk()
  * 参数：
  * start: 期望的起始地址。0 表示自动分配。
  * len: 长度。
+ * flags: MAP_POPULATE 表示立即分配所有页面, 否则访问时才分配。
  */
 uint64 sys_mmap()
 {
-    proc_t *cur_proc = myproc();
     uint64 start_addr;
     uint64 length;
+    uint32 flags;
 
     arg_uint64(0, &start_addr);
     arg_uint64(1, &length);
+    arg_uint32(2, &flags);
 
     // 检查长度对齐
     if (length == 0 || (length % PGSIZE) != 0) {
@@ -69,26 +74,8 @@ uint64 sys_mmap()
     uint32 page_count = length / PGSIZE;
     int perm = PTE_R | PTE_W | PTE_U;
 
-    // 执行映射
-    uvm_mmap(start_addr, page_count, perm);
-
-    // 如果是自动分配，需要回查实际分配到的地址
-    if (start_addr == 0) {
-        // 这是一个简单的启发式查找：找到 size 匹配的 mmap 区域
-        // 更严谨的做法是修改 uvm_mmap 让其返回地址
-        mmap_region_t *region = cur_proc->mmap;
-        while (region) {
-            if (region->npages == page_count) {
-                start_addr = region->begin;
-                break; 
-            }
-            region = region->next;
-        }
-        
-        if (start_addr == 0) return (uint64)-1; // Should not happen
-    }
-
-    return start_addr;
+    // 执行映射 (内存不足时失败), 返回实际映射的起始地址
+    return uvm_mmap(start_addr, page_count, perm, (flags & MAP_POPULATE) != 0);
 }
 
 /*
@@ -106,7 +93,8 @@ uint64 sys_munmap()
     if ((start_addr % PGSIZE) != 0) return (uint64)-1;
 
     uint32 page_count = length / PGSIZE;
-    uvm_munmap(start_addr, page_count);
+    if (uvm_munmap(start_addr, page_count) < 0)
+        return (uint64)-1;
 
     return 0;
 }
@@ -222,4 +210,87 @@ uint64 sys_show_buffer() {
 uint64 sys_flush_buffer() {
     uint32 count; arg_uint32(0, &count);
     return buffer_freemem(count);
+}
+
+uint64 sys_show_pmem() {
+    pmem_stat();
+    return 0;
+}
+
+// 设置缺页预取窗口: 必须是不超过512的2的幂, 1表示关闭; 返回原来的窗口大小
+uint64 sys_fault_around() {
+    uint32 npages; arg_uint32(0, &npages);
+    if (npages == 0 || npages > 512 || (npages & (npages - 1)) != 0)
+        return (uint64)-1;
+
+    proc_t *p = myproc();
+    uint32 old = p->fault_around;
+    p->fault_around = npages;
+    return old;
+}
+
+uint64 sys_show_fault() {
+    uvm_fault_stat(myproc());
+    return 0;
+}
+
+// 创建共享内存对象: 参数为长度 (字节, 页对齐), 返回对象编号
+uint64 sys_shm_create() {
+    uint64 length; arg_uint64(0, &length);
+    if (length == 0 || (length % PGSIZE) != 0 || length / PGSIZE > SHM_MAX_PAGES)
+        return (uint64)-1;
+    return (uint64)shm_create(length / PGSIZE);
+}
+
+// 映射共享内存对象: 参数为对象编号和期望的起始地址 (0表示自动分配), 返回实际映射的地址
+uint64 sys_shm_map() {
+    uint32 id; arg_uint32(0, &id);
+    uint64 start_addr; arg_uint64(1, &start_addr);
+    if ((start_addr % PGSIZE) != 0)
+        return (uint64)-1;
+    return shm_map((int)id, start_addr);
+}
+
+uint64 sys_shm_destroy() {
+    uint32 id; arg_uint32(0, &id);
+    return (uint64)shm_destroy((int)id);
+}
+
+// 参数非0时允许空闲扫描合并当前进程的相同页面, 子进程继承该设置
+uint64 sys_ksm() {
+    uint32 enable; arg_uint32(0, &enable);
+    myproc()->ksm = (enable != 0);
+    return 0;
+}
+
+uint64 sys_show_ksm() {
+    ksm_stat();
+    return 0;
+}
+
+uint64 sys_show_swap() {
+    swap_stat();
+    return 0;
+}
+
+uint64 sys_show_sched() {
+    sched_stat();
+    return 0;
+}
+
+// 设置进程 pid (0表示当前进程) 的nice值 (-20 ~ 19), 成功返回0, 失败返回-1
+uint64 sys_setnice() {
+    uint32 pid, nice;
+    arg_uint32(0, &pid);
+    arg_uint32(1, &nice);
+    return (uint64)sched_set_nice((int)pid, (int)nice);
+}
+
+// 设置当前进程的实时调度类: 0普通, 1 FIFO (param为优先级1~99), 2 截止时间 (param为周期, 单位tick)
+// 成功返回0, 参数非法返回-1
+uint64 sys_sched_rt() {
+    uint32 rt_class, param;
+    arg_uint32(0, &rt_class);
+    arg_uint32(1, &param);
+    return (uint64)sched_set_rt((int)rt_class, param);
 }
\ No newline at end of file
@@ -24,8 +24,20 @@
 #define SYS_put_block 19    // 释放1个描述block的buffer (测试buffer_put)
 #define SYS_show_buffer 20  // 输出buffer链表的状态
 #define SYS_flush_buffer 21 // 释放非活跃链表中buffer持有的物理内存资源 (测试buffer_freemem)
+#define SYS_show_pmem 22    // 输出物理内存池与CPU本地页面缓存的状态
+#define SYS_fault_around 23 // 设置当前进程的缺页预取窗口 (页数)
+#define SYS_show_fault 24   // 输出当前进程的缺页统计
+#define SYS_shm_create 25   // 创建共享内存对象
+#define SYS_shm_map 26      // 把共享内存对象映射到当前进程 (用munmap解除映射)
+#define SYS_shm_destroy 27  // 销毁共享内存对象
+#define SYS_ksm 28          // 允许/禁止合并当前进程的相同页面 (KSM)
+#define SYS_show_ksm 29     // 输出KSM的统计信息
+#define SYS_show_swap 30    // 输出交换区的统计信息
+#define SYS_show_sched 31   // 输出各CPU就绪队列的统计信息
+#define SYS_setnice 32      // 设置进程的nice值 (调度权重)
+#define SYS_sched_rt 33     // 设置当前进程的实时调度类 (FIFO/截止时间)
 
-#define SYS_MAX_NUM 21
+#define SYS_MAX_NUM 33
 
 /* 可以传入的最大字符串长度 */
 #define STR_MAXLEN 127
\ No newline at end of file
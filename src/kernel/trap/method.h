@@ -14,6 +14,8 @@ void timer_create();           // 时钟创建
 void timer_update();           // 时钟更新(ticks++)
 uint64 timer_get_ticks();      // 获取时钟的tick
 void timer_wait(uint64 ntick); // 等待ntick
+uint64 timer_take_ticks();     // 取出M模式记录的tick数
+void ipi_send(int hart);       // 向hart发送软件中断(IPI)
 
 // trap的初始化和处理逻辑
 
@@ -26,4 +28,4 @@ void trap_user_return();
 // 辅助函数: 外设中断和时钟中断处理
 
 void external_interrupt_handler();
-void timer_interrupt_handler();
\ No newline at end of file
+bool timer_interrupt_handler();
\ No newline at end of file
@@ -11,8 +11,9 @@
 extern void timer_vector();
 
 // 每个 CPU 核心在 M-mode 中断处理时需要的临时存储区
-// 保存: [0-2] 临时寄存器, [3] mtimecmp 地址, [4] interval 间隔
-static uint64 timer_scratch_pad[NCPU][5];
+// 保存: [0-2] 临时寄存器, [3] mtimecmp 地址, [4] interval 间隔,
+//       [5] msip 地址 (收到 IPI 时清除), [6] 尚未被 S-mode 取走的时钟 tick 数
+static uint64 timer_scratch_pad[NCPU][7];
 
 void timer_init()
 {
@@ -29,6 +30,8 @@ void timer_init()
     uint64 *scratch = timer_scratch_pad[cpuid];
     scratch[3] = (uint64)mtimecmp_reg;
     scratch[4] = INTERVAL;
+    scratch[5] = CLINT_MSIP(cpuid);
+    scratch[6] = 0;
 
     // 4. 将 scratch 地址写入 mscratch 寄存器
     w_mscratch((uint64)scratch);
@@ -36,9 +39,22 @@ void timer_init()
     // 5. 设置 M-mode 异常向量表地址
     w_mtvec((uint64)timer_vector);
 
-    // 6. 开启 M-mode 全局中断和时钟中断
+    // 6. 开启 M-mode 全局中断、时钟中断和软件中断 (IPI)
     w_mstatus(r_mstatus() | MSTATUS_MIE);
-    w_mie(r_mie() | MIE_MTIE);
+    w_mie(r_mie() | MIE_MTIE | MIE_MSIE);
+}
+
+// 取出本 CPU 自上次调用以来的时钟 tick 数 (S-mode, 中断关闭时调用)
+// M-mode 在同一个 hart 上累加, 原子交换保证不会丢失
+uint64 timer_take_ticks()
+{
+    return __atomic_exchange_n(&timer_scratch_pad[mycpuid()][6], 0, __ATOMIC_RELAXED);
+}
+
+// 通过 CLINT 向 hart 发送软件中断, M-mode 清除后以 S-mode 软件中断的形式转发
+void ipi_send(int hart)
+{
+    *(volatile uint32 *)CLINT_MSIP(hart) = 1;
 }
 
 /* -------------------------------------------------------------------------
@@ -76,12 +76,13 @@ void trap_kernel_handler()
 
     int irq_type = scause_val & 0xf;
     int is_async = (scause_val & 0x8000000000000000ul) != 0;
+    bool tick = false;
 
     if (is_async) {
         // --- 中断处理 ---
         switch (irq_type) {
-        case 1: // S 态软件中断（实际上由 M 态时钟中断转发而来）
-            timer_interrupt_handler();
+        case 1: // S 态软件中断（实际上由 M 态时钟中断或者其他 CPU 的 IPI 转发而来）
+            tick = timer_interrupt_handler();
             break;
         case 9: // S 态外部中断（外设）
             external_interrupt_handler();
@@ -99,10 +100,13 @@ void trap_kernel_handler()
     }
 
     // 抢占式调度点：
-    // 如果是时钟中断，且当前有进程正在运行（而非调度器或空闲线程），则让出 CPU
+    // 如果是时钟中断，且当前有进程正在运行（而非调度器或空闲线程），由调度策略决定是否让出 CPU
     if (is_async && irq_type == 1) {
-        if (myproc() != NULL && myproc()->state == RUNNING) {
+        if (myproc() != NULL && myproc()->state == RUNNING && sched_tick(tick)) {
+            // 被抢占的内核路径可能正持有用户页面的物理地址, 期间不允许KSM修改页表
+            myproc()->kpreempted = true;
             proc_yield();
+            myproc()->kpreempted = false;
         }
     }
 
@@ -132,15 +136,20 @@ void external_interrupt_handler()
     }
 }
 
-// 处理时钟中断
-void timer_interrupt_handler()
+// 处理时钟中断 (同一个软件中断也用于转发其他 CPU 发来的 IPI)
+// 返回是否经过了时钟 tick, 只是 IPI 时返回 false
+bool timer_interrupt_handler()
 {
+    // 清除 SIP 寄存器中的软件中断挂起位
+    // 告知硬件该中断已被处理 (先清除再读取 tick 数, 之后到来的时钟中断会再次置位)
+    w_sip(r_sip() & ~2);
+
+    uint64 ticks = timer_take_ticks();
+
     // 只有 CPU 0 负责更新全局系统滴答数
     if (mycpuid() == 0) {
-        timer_update();
+        for (uint64 i = 0; i < ticks; i++)
+            timer_update();
     }
-
-    // 清除 SIP 寄存器中的软件中断挂起位
-    // 告知硬件该中断已被处理
-    w_sip(r_sip() & ~2);
+    return ticks > 0;
 }
\ No newline at end of file
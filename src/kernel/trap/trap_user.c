@@ -38,12 +38,13 @@ void trap_user_handler()
     uint64 scause_reg = r_scause();
     int cause_type = scause_reg & 0xf;
     bool is_interrupt = (scause_reg & 0x8000000000000000ul) != 0;
+    bool tick = false;
 
     if (is_interrupt) {
         // --- 处理中断 ---
         switch (cause_type) {
-        case 1: // S模式软件中断 (由M模式时钟中断触发)
-            timer_interrupt_handler();
+        case 1: // S模式软件中断 (由M模式时钟中断或者其他CPU的IPI触发)
+            tick = timer_interrupt_handler();
             break;
         case 9: // S模式外部中断 (PLIC)
             external_interrupt_handler();
@@ -69,21 +70,18 @@ void trap_user_handler()
         case 13: // Load Page Fault
         case 15: // Store/AMO Page Fault
         {
-            // 处理用户栈的自动增长
+            // 按需分配页面 / 写时复制 / 用户栈增长
             uint64 bad_addr = r_stval();
-            // printf("User Page Fault: addr=%p, type=%d\n", bad_addr, cause_type);
-            
-            uint64 current_stack_pages = curr_proc->ustack_npage;
-            // 尝试扩展用户栈
-            uint64 new_stack_pages = uvm_ustack_grow(curr_proc->pgtbl, current_stack_pages, bad_addr);
-            
-            if (new_stack_pages == (uint64)-1) {
-                printf("Stack overflow or invalid access: pid=%d, addr=%p\n", curr_proc->pid, bad_addr);
+
+            // 换入页面需要睡眠等待磁盘, 处理期间开启中断
+            intr_on();
+            int ret = uvm_fault(curr_proc, bad_addr, cause_type == 15);
+            intr_off();
+            if (ret != 0) {
+                printf("Invalid access or out of memory: pid=%d, addr=%p\n", curr_proc->pid, bad_addr);
                 curr_proc->state = ZOMBIE; // 杀死进程
                 curr_proc->exit_code = -1;
                 proc_sched();
-            } else {
-                curr_proc->ustack_npage = new_stack_pages;
             }
             break;
         }
@@ -98,8 +96,8 @@ void trap_user_handler()
     }
 
     // 4. 检查是否需要调度
-    // 如果是时钟中断，说明时间片用完，强制让出 CPU
-    if (is_interrupt && cause_type == 1) {
+    // 如果是时钟中断或IPI，由调度策略决定是否需要让出 CPU (时间片用完或者有更高优先级的实时进程)
+    if (is_interrupt && cause_type == 1 && sched_tick(tick)) {
         proc_yield();
     }
 
@@ -140,8 +138,8 @@ void trap_user_return()
     w_sepc(frame->user_to_kern_epc);
 
     // 6. 准备页表
-    // 生成写入 satp 寄存器的值
-    uint64 satp_val = MAKE_SATP(curr_proc->pgtbl);
+    // 生成写入 satp 寄存器的值 (带上进程的ASID, 必要时先刷新TLB)
+    uint64 satp_val = asid_activate(curr_proc);
 
     // 7. 跳转到 trampoline 中的 user_return
     // 函数原型: void user_return(uint64 trapframe_va, uint64 satp_val);
@@ -138,4 +138,212 @@ int main()
 	syscall(SYS_show_buffer);
 
 	while(1);
-}
\ No newline at end of file
+}
+
+// test-4: shared memory
+/*#include "sys.h"
+
+#define PGSIZE 4096
+
+// 比较观察值和期望值, 输出 PASS/FAIL
+static int failed;
+static void check(char *name, int ok)
+{
+	syscall(SYS_print_str, name);
+	syscall(SYS_print_str, ok ? ": PASS\n" : ": FAIL\n");
+	if (!ok)
+		failed++;
+}
+
+int main()
+{
+	// 创建两页的共享内存对象, 映射到自动选择的地址
+	int id = syscall(SYS_shm_create, 2 * PGSIZE);
+	char *addr = (char *)syscall(SYS_shm_map, id, 0);
+	check("create and map", id >= 0 && (long)addr != -1);
+
+	// 父进程写入, 子进程通过继承的共享映射读到同样的内容并修改, 用退出码报告读到的内容
+	addr[0] = 'A';
+	addr[PGSIZE] = 'a';
+	if (syscall(SYS_fork) == 0) {
+		int ok = (addr[0] == 'A' && addr[PGSIZE] == 'a');
+		addr[0] = 'B';
+		syscall(SYS_exit, ok ? 0 : 1);
+	}
+	int code = -1;
+	syscall(SYS_wait, &code);
+	check("child reads parent's write", code == 0);
+	check("parent reads child's write", addr[0] == 'B');
+
+	// 同一个对象的第二个映射看到同样的页面
+	char *alias = (char *)syscall(SYS_shm_map, id, 0);
+	alias[0] = 'C';
+	alias[PGSIZE] = 'c';
+	check("second mapping aliases the object", alias != addr && addr[0] == 'C' && addr[PGSIZE] == 'c');
+
+	// 非法地址、与已有映射重叠都应返回-1
+	check("bad address rejected", syscall(SYS_shm_map, id, PGSIZE) == -1);
+	check("overlap rejected", syscall(SYS_shm_map, id, addr + PGSIZE) == -1);
+
+	// 销毁后已有映射仍然可用, 但不能再建立新映射
+	syscall(SYS_shm_destroy, id);
+	check("mapping survives destroy", addr[0] == 'C' && alias[PGSIZE] == 'c');
+	check("map after destroy rejected", syscall(SYS_shm_map, id, 0) == -1);
+
+	syscall(SYS_munmap, alias, 2 * PGSIZE);
+	syscall(SYS_munmap, addr, 2 * PGSIZE);
+	syscall(SYS_show_pmem);
+
+	syscall(SYS_print_str, failed ? "test-4: FAIL\n" : "test-4: PASS\n");
+	while(1);
+}
+*/
+
+// test-5: fault-around, KSM and swap
+/*#include "sys.h"
+
+#define PGSIZE 4096
+#define NPAGES 256
+
+static int failed;
+static void check(char *name, int ok)
+{
+	syscall(SYS_print_str, name);
+	syscall(SYS_print_str, ok ? ": PASS\n" : ": FAIL\n");
+	if (!ok)
+		failed++;
+}
+
+int main()
+{
+	// 按需分配的映射: 打开16页的缺页预取后顺序访问, 新页面应该全为0
+	syscall(SYS_fault_around, 16);
+	char *mem = (char *)syscall(SYS_mmap, 0, NPAGES * PGSIZE, 0);
+	int ok = ((long)mem != -1);
+	for (int i = 0; ok && i < NPAGES; i++) {
+		ok = (mem[i * PGSIZE] == 0 && mem[i * PGSIZE + PGSIZE - 1] == 0);
+		mem[i * PGSIZE] = 1;
+	}
+	check("fault-around pages are zeroed", ok);
+	syscall(SYS_show_fault);
+
+	// 所有页面内容相同, 允许KSM合并后等待几轮空闲扫描, 合并不能改变页面内容
+	syscall(SYS_ksm, 1);
+	syscall(SYS_sleep, 50);
+	syscall(SYS_show_ksm);
+	ok = 1;
+	for (int i = 0; i < NPAGES; i++)
+		ok = ok && (mem[i * PGSIZE] == 1 && mem[i * PGSIZE + 1] == 0);
+	check("merged pages keep their content", ok);
+
+	// 写入合并过的页面触发写时复制, 每个页面得到私有副本
+	for (int i = 0; i < NPAGES; i++)
+		mem[i * PGSIZE] = (char)i;
+	ok = 1;
+	for (int i = 0; i < NPAGES; i++)
+		ok = ok && (mem[i * PGSIZE] == (char)i);
+	check("copy-on-write separates merged pages", ok);
+	syscall(SYS_show_ksm);
+
+	// 子进程复制全部页面 (包括可能已经换出的页面), 双方的修改互不可见
+	if (syscall(SYS_fork) == 0) {
+		ok = 1;
+		for (int i = 0; i < NPAGES; i++) {
+			ok = ok && (mem[i * PGSIZE] == (char)i);
+			mem[i * PGSIZE] = 0x55;
+		}
+		syscall(SYS_exit, ok ? 0 : 1);
+	}
+	int code = -1;
+	syscall(SYS_wait, &code);
+	ok = 1;
+	for (int i = 0; i < NPAGES; i++)
+		ok = ok && (mem[i * PGSIZE] == (char)i);
+	check("child sees parent's pages", code == 0);
+	check("child's writes stay private", ok);
+	syscall(SYS_show_swap);
+
+	syscall(SYS_munmap, mem, NPAGES * PGSIZE);
+	syscall(SYS_print_str, failed ? "test-5: FAIL\n" : "test-5: PASS\n");
+	while(1);
+}
+*/
+
+// test-6: scheduling and wakeup (默认的加权公平调度)
+/*#include "sys.h"
+
+#define PGSIZE 4096
+#define NWORKER 4
+#define RT_JOBS 10
+
+// 父子进程通过共享内存交换观察结果
+struct shared {
+	volatile int stop;              // 父进程通知CPU密集型子进程结束
+	volatile long count[NWORKER];   // 各CPU密集型子进程的循环次数
+	volatile int rt_jobs[2];        // 实时子进程完成的作业数 (截止时间类, FIFO)
+};
+
+static int failed;
+static void check(char *name, int ok)
+{
+	syscall(SYS_print_str, name);
+	syscall(SYS_print_str, ok ? ": PASS\n" : ": FAIL\n");
+	if (!ok)
+		failed++;
+}
+
+int main()
+{
+	int id = syscall(SYS_shm_create, PGSIZE);
+	struct shared *sh = (struct shared *)syscall(SYS_shm_map, id, 0);
+
+	// CPU密集型子进程: 两个 nice 0, 两个 nice 10, 在两个CPU上竞争
+	for (int i = 0; i < NWORKER; i++) {
+		if (syscall(SYS_fork) == 0) {
+			syscall(SYS_setnice, 0, i < 2 ? 0 : 10);
+			while (!sh->stop)
+				sh->count[i]++;
+			syscall(SYS_exit, 0);
+		}
+	}
+
+	// 实时子进程 (截止时间类, FIFO): 每个作业睡眠2个tick, 醒来后先于CPU密集型进程运行,
+	// 所以至少需要 2 * RT_JOBS 个tick; 如果醒来后要在普通队列中排队, 每个作业还要多等几个tick
+	for (int i = 0; i < 2; i++) {
+		if (syscall(SYS_fork) == 0) {
+			syscall(SYS_sched_rt, i == 0 ? 2 : 1, i == 0 ? 2 : 50);
+			for (int j = 0; j < RT_JOBS; j++) {
+				syscall(SYS_sleep, 2);
+				sh->rt_jobs[i]++;
+			}
+			syscall(SYS_exit, 0);
+		}
+	}
+
+	// 父进程睡眠期间子进程竞争CPU, 睡眠本身也检验了负载下的唤醒
+	syscall(SYS_sleep, 2 * RT_JOBS + 20);
+	check("deadline jobs finish under load", sh->rt_jobs[0] == RT_JOBS);
+	check("fifo jobs finish under load", sh->rt_jobs[1] == RT_JOBS);
+	syscall(SYS_show_sched);
+
+	sh->stop = 1;
+	for (int i = 0; i < NWORKER + 2; i++)
+		syscall(SYS_wait, 0);
+
+	// 权重相差约9倍, 至少要求 nice 0 得到两倍于 nice 10 的CPU时间
+	long heavy = sh->count[0] + sh->count[1];
+	long light = sh->count[2] + sh->count[3];
+	syscall(SYS_print_str, "nice 0 / nice 10 loops: ");
+	syscall(SYS_print_int, (int)(heavy / 1000));
+	syscall(SYS_print_str, "k / ");
+	syscall(SYS_print_int, (int)(light / 1000));
+	syscall(SYS_print_str, "k\n");
+	check("nice 0 gets more CPU than nice 10", light > 0 && heavy > 2 * light);
+	check("every worker made progress", sh->count[0] && sh->count[1] && sh->count[2] && sh->count[3]);
+
+	syscall(SYS_munmap, sh, PGSIZE);
+	syscall(SYS_shm_destroy, id);
+	syscall(SYS_print_str, failed ? "test-6: FAIL\n" : "test-6: PASS\n");
+	while(1);
+}
+*/
\ No newline at end of file